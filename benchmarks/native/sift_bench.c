@@ -0,0 +1,444 @@
+/*
+ * Native microbenchmarks for the sift macros in ext/d_heap/d_heap.h.
+ *
+ * This measures the heap without any ruby method dispatch, VALUE conversion,
+ * or allocation, so that differences between sift strategies aren't swamped
+ * by interpreter overhead.  It only needs ruby's headers, not libruby.  Use
+ * bin/bench_native to compile and run it and to convert its output into
+ * benchmark_driver's results.yml format.
+ *
+ * Output is tab separated, with one line per measurement:
+ *
+ *     scenario dist d layout n loops seconds cycles instructions l1d_misses
+ *     llc_misses branch_misses
+ *
+ * Hardware counters are read via perf_event_open(2) when it is available, and
+ * are printed as -1 when they aren't (e.g. non-linux, or perf_event_paranoid).
+ */
+#include "d_heap.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#    define BENCH_HAVE_PERF 1
+#endif
+
+#define BENCH_MAX_LIST 64
+
+/********************************************************************
+ *
+ * Hardware counters
+ *
+ ********************************************************************/
+
+typedef struct bench_counter
+{
+    const char        *name;
+    uint32_t           type;
+    uint64_t           config;
+    int                fd;
+    long long          value;
+} bench_counter_t;
+
+#ifdef BENCH_HAVE_PERF
+#    define BENCH_HW(name, config) { name, PERF_TYPE_HARDWARE, config, -1, -1 }
+#    define BENCH_HW_CACHE(name, cache)                                        \
+        { name,                                                                \
+          PERF_TYPE_HW_CACHE,                                                  \
+          (cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                       \
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),                           \
+          -1,                                                                  \
+          -1 }
+#else
+#    define BENCH_HW(name, config)       { name, 0, 0, -1, -1 }
+#    define BENCH_HW_CACHE(name, cache)  { name, 0, 0, -1, -1 }
+#endif
+
+static bench_counter_t bench_counters[] = {
+    BENCH_HW("cycles", PERF_COUNT_HW_CPU_CYCLES),
+    BENCH_HW("instructions", PERF_COUNT_HW_INSTRUCTIONS),
+    BENCH_HW_CACHE("l1d_misses", PERF_COUNT_HW_CACHE_L1D),
+    BENCH_HW_CACHE("llc_misses", PERF_COUNT_HW_CACHE_LL),
+    BENCH_HW("branch_misses", PERF_COUNT_HW_BRANCH_MISSES),
+};
+
+#define BENCH_COUNTERS_LEN                                                     \
+    (sizeof(bench_counters) / sizeof(bench_counters[0]))
+
+static void
+bench_counters_open(void)
+{
+#ifdef BENCH_HAVE_PERF
+    for (size_t i = 0; i < BENCH_COUNTERS_LEN; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = bench_counters[i].type;
+        attr.config         = bench_counters[i].config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        bench_counters[i].fd =
+          (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static void
+bench_counters_start(void)
+{
+    for (size_t i = 0; i < BENCH_COUNTERS_LEN; ++i) {
+        bench_counters[i].value = -1;
+#ifdef BENCH_HAVE_PERF
+        if (bench_counters[i].fd < 0) continue;
+        ioctl(bench_counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(bench_counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+}
+
+static void
+bench_counters_stop(void)
+{
+#ifdef BENCH_HAVE_PERF
+    for (size_t i = 0; i < BENCH_COUNTERS_LEN; ++i) {
+        long long value;
+        if (bench_counters[i].fd < 0) continue;
+        ioctl(bench_counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(bench_counters[i].fd, &value, sizeof(value)) == sizeof(value))
+            bench_counters[i].value = value;
+    }
+#endif
+}
+
+/********************************************************************
+ *
+ * Score distributions
+ *
+ ********************************************************************/
+
+static uint64_t bench_rng_state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*: fast, and good enough to shuffle heap entries.
+static inline uint64_t
+bench_rand(void)
+{
+    bench_rng_state ^= bench_rng_state >> 12;
+    bench_rng_state ^= bench_rng_state << 25;
+    bench_rng_state ^= bench_rng_state >> 27;
+    return bench_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+#define BENCH_RAND_MAX     100000000
+#define BENCH_CLUSTERS     16
+#define BENCH_CLUSTER_SIZE 1000
+
+static const char *bench_dists[] = {
+    "random",
+    "ascending",
+    "descending",
+    "clustered",
+};
+
+#define BENCH_DISTS_LEN (sizeof(bench_dists) / sizeof(bench_dists[0]))
+
+static int
+bench_fill_scores(const char *dist, SCORE *scores, size_t len)
+{
+    if (!strcmp(dist, "random")) {
+        for (size_t i = 0; i < len; ++i)
+            scores[i] = (SCORE)(bench_rand() % BENCH_RAND_MAX);
+    } else if (!strcmp(dist, "ascending")) {
+        for (size_t i = 0; i < len; ++i)
+            scores[i] = (SCORE)i;
+    } else if (!strcmp(dist, "descending")) {
+        for (size_t i = 0; i < len; ++i)
+            scores[i] = (SCORE)(len - i);
+    } else if (!strcmp(dist, "clustered")) {
+        SCORE centers[BENCH_CLUSTERS];
+        for (size_t i = 0; i < BENCH_CLUSTERS; ++i)
+            centers[i] = (SCORE)(bench_rand() % BENCH_RAND_MAX);
+        for (size_t i = 0; i < len; ++i)
+            scores[i] = centers[bench_rand() % BENCH_CLUSTERS] +
+                        (SCORE)(bench_rand() % BENCH_CLUSTER_SIZE);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/********************************************************************
+ *
+ * Heap operations (the same sift macros used by DHeap)
+ *
+ ********************************************************************/
+
+static void
+bench_heap_init(dheap_t *heap, int d, int paged, size_t capa)
+{
+    memset(heap, 0, sizeof(*heap));
+    heap->d       = d;
+    heap->capa    = capa;
+    if (paged) dheap_set_pages(heap);
+    heap->entries = calloc(capa, sizeof(ENTRY));
+    if (!heap->entries) {
+        perror("calloc");
+        exit(1);
+    }
+}
+
+static inline void
+bench_push(dheap_t *heap, SCORE score)
+{
+    ENTRY entry = { score, (VALUE)heap->size };
+    DHEAP_SET(dheap, heap, heap->size, entry);
+    ++heap->size;
+    DHEAP_LAYOUT_STMT(dheap, heap, DHEAP_SIFT_UP, DHEAP_IDX_LAST(heap));
+}
+
+static inline SCORE
+bench_pop(dheap_t *heap)
+{
+    SCORE popped = DHEAP_SCORE(heap, 0);
+    if (0 < --heap->size) {
+        DHEAP_SET(dheap, heap, 0, heap->entries[heap->size]);
+        DHEAP_LAYOUT_STMT(dheap, heap, DHEAP_SIFT_DOWN, 0);
+    }
+    return popped;
+}
+
+/********************************************************************
+ *
+ * Scenarios
+ *
+ ********************************************************************/
+
+static volatile SCORE bench_sink;
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Only the measured loop is timed and counted, not pre-filling the heap.
+static double bench_start_time, bench_seconds;
+
+static void
+bench_measure_start(void)
+{
+    bench_counters_start();
+    bench_start_time = bench_now();
+}
+
+static void
+bench_measure_stop(void)
+{
+    bench_seconds = bench_now() - bench_start_time;
+    bench_counters_stop();
+}
+
+// Like benchmarks/push_pop.yml: one loop is a push and a pop on a heap that
+// has been pre-filled with N entries.
+static size_t
+bench_push_pop(dheap_t *heap, const SCORE *scores, size_t n, size_t loops)
+{
+    SCORE sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        bench_push(heap, scores[i]);
+    bench_measure_start();
+    for (size_t i = 0; i < loops; ++i) {
+        bench_push(heap, scores[n + i]);
+        sum += bench_pop(heap);
+    }
+    bench_measure_stop();
+    bench_sink = sum;
+    return loops;
+}
+
+// Like benchmarks/push_n_pop_n.yml: one loop is either a push or a pop,
+// alternating between pushing N entries and popping N entries.
+static size_t
+bench_push_n_pop_n(dheap_t *heap, const SCORE *scores, size_t n, size_t loops)
+{
+    SCORE  sum    = 0;
+    size_t rounds = loops / (2 * n);
+    if (rounds < 1) rounds = 1;
+    bench_measure_start();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < n; ++i)
+            bench_push(heap, scores[i]);
+        for (size_t i = 0; i < n; ++i)
+            sum += bench_pop(heap);
+    }
+    bench_measure_stop();
+    bench_sink = sum;
+    return rounds * 2 * n;
+}
+
+typedef size_t (*bench_scenario_fn)(dheap_t *, const SCORE *, size_t, size_t);
+
+static const struct
+{
+    const char       *name;
+    bench_scenario_fn fn;
+} bench_scenarios[] = {
+    { "push_pop", bench_push_pop },
+    { "push_n_pop_n", bench_push_n_pop_n },
+};
+
+#define BENCH_SCENARIOS_LEN (sizeof(bench_scenarios) / sizeof(bench_scenarios[0]))
+
+static void
+bench_run(size_t      scenario,
+          const char *dist,
+          int         d,
+          const char *layout,
+          size_t      n,
+          size_t      loops)
+{
+    dheap_t heap;
+    size_t  len    = n + loops;
+    SCORE  *scores = malloc(len * sizeof(SCORE));
+    if (!scores || !bench_fill_scores(dist, scores, len)) {
+        fprintf(stderr, "unable to generate %s scores\n", dist);
+        exit(1);
+    }
+    bench_heap_init(&heap, d, !strcmp(layout, "paged"), n + 1);
+
+    loops = bench_scenarios[scenario].fn(&heap, scores, n, loops);
+
+    printf("%s\t%s\t%d\t%s\t%zu\t%zu\t%.9f",
+           bench_scenarios[scenario].name,
+           dist,
+           d,
+           layout,
+           n,
+           loops,
+           bench_seconds);
+    for (size_t i = 0; i < BENCH_COUNTERS_LEN; ++i)
+        printf("\t%lld", bench_counters[i].value);
+    printf("\n");
+    fflush(stdout);
+
+    free(heap.entries);
+    free(scores);
+}
+
+/********************************************************************
+ *
+ * Command line
+ *
+ ********************************************************************/
+
+static size_t
+bench_parse_list(char *arg, const char **list)
+{
+    size_t len = 0;
+    for (char *tok = strtok(arg, ","); tok && len < BENCH_MAX_LIST;
+         tok       = strtok(NULL, ",")) {
+        list[len++] = tok;
+    }
+    return len;
+}
+
+static void
+bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s scenarios] [-D dists] [-d d_vals] [-l layouts]\n"
+            "          [-n n_vals] [-i iterations] [-r repeat_count]\n"
+            "  lists are comma separated, e.g. -d 2,4,6 -n 1000,10000\n"
+            "  scenarios: push_pop,push_n_pop_n\n"
+            "  dists:     random,ascending,descending,clustered\n"
+            "  layouts:   flat,paged\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *scenarios[BENCH_MAX_LIST] = { "push_pop", "push_n_pop_n" };
+    const char *dists[BENCH_MAX_LIST];
+    const char *d_vals[BENCH_MAX_LIST] = { "2", "4", "6", "8", "16" };
+    const char *layouts[BENCH_MAX_LIST] = { "flat" };
+    const char *n_vals[BENCH_MAX_LIST]  = { "1000", "100000", "1000000" };
+    size_t      scenarios_len = 2, dists_len = BENCH_DISTS_LEN;
+    size_t      d_len = 5, layouts_len = 1, n_len = 3;
+    size_t      loops   = 1000000;
+    long        repeats = 4;
+    int         opt;
+
+    for (size_t i = 0; i < BENCH_DISTS_LEN; ++i)
+        dists[i] = bench_dists[i];
+
+    while ((opt = getopt(argc, argv, "s:D:d:l:n:i:r:h")) != -1) {
+        switch (opt) {
+        case 's': scenarios_len = bench_parse_list(optarg, scenarios); break;
+        case 'D': dists_len = bench_parse_list(optarg, dists); break;
+        case 'd': d_len = bench_parse_list(optarg, d_vals); break;
+        case 'l': layouts_len = bench_parse_list(optarg, layouts); break;
+        case 'n': n_len = bench_parse_list(optarg, n_vals); break;
+        case 'i': loops = strtoul(optarg, NULL, 10); break;
+        case 'r': repeats = strtol(optarg, NULL, 10); break;
+        default: bench_usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    for (size_t i = 0; i < layouts_len; ++i) {
+        if (strcmp(layouts[i], "flat") && strcmp(layouts[i], "paged")) {
+            fprintf(stderr, "unknown layout: %s\n", layouts[i]);
+            return 2;
+        }
+    }
+
+    bench_counters_open();
+    printf("scenario\tdist\td\tlayout\tn\tloops\tseconds");
+    for (size_t i = 0; i < BENCH_COUNTERS_LEN; ++i)
+        printf("\t%s", bench_counters[i].name);
+    printf("\n");
+
+    for (size_t s = 0; s < scenarios_len; ++s) {
+        size_t scenario = BENCH_SCENARIOS_LEN;
+        for (size_t i = 0; i < BENCH_SCENARIOS_LEN; ++i) {
+            if (!strcmp(scenarios[s], bench_scenarios[i].name)) scenario = i;
+        }
+        if (scenario == BENCH_SCENARIOS_LEN) {
+            fprintf(stderr, "unknown scenario: %s\n", scenarios[s]);
+            return 2;
+        }
+        for (size_t t = 0; t < dists_len; ++t) {
+            for (size_t i = 0; i < d_len; ++i) {
+                int d = atoi(d_vals[i]);
+                if (d < 2) {
+                    fprintf(stderr, "invalid d: %s\n", d_vals[i]);
+                    return 2;
+                }
+                for (size_t l = 0; l < layouts_len; ++l) {
+                    for (size_t j = 0; j < n_len; ++j) {
+                        size_t n = strtoul(n_vals[j], NULL, 10);
+                        if (n < 1) {
+                            fprintf(stderr, "invalid n: %s\n", n_vals[j]);
+                            return 2;
+                        }
+                        for (long r = 0; r < repeats; ++r)
+                            bench_run(
+                              scenario, dists[t], d, layouts[l], n, loops);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "ruby.h"
 #include <float.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
 
 #if CHAR_BIT != 8
 #    error "DHeap assumes 8-bit bytes"
@@ -20,159 +22,21 @@
 #    error "DHeap assumes 64-bit 'unsigned long long'"
 #endif
 
-/********************************************************************
- *
- * Type definitions
- *
- ********************************************************************/
-
-typedef struct dheap_struct dheap_t;
-typedef struct dheap_entry  ENTRY;
-
-typedef double SCORE;
-
-/********************************************************************
- *
- * Struct definitions
- *
- ********************************************************************/
-
-struct dheap_struct
-{
-    int    d;
-    size_t size;
-    size_t capa;
-    ENTRY *entries;
-#ifdef DHEAP_MAP
-    VALUE indexes; // Hash
-#endif
-};
-
-struct dheap_entry
-{
-    SCORE score;
-    VALUE value;
-};
-
-#define DHEAPMAP_P(heap) UNLIKELY(RTEST((heap)->indexes))
-
-/********************************************************************
- *
- * Constant definitions
- *
- ********************************************************************/
-
-#define DHEAP_DEFAULT_D 6
-#define DHEAP_MAX_D     INT_MAX
-
-// sizeof(ENTRY) => 16 bytes, 128-bits
-// one kilobyte = 32 * 32 bytes
-#define DHEAP_DEFAULT_CAPA  32
-#define DHEAP_MAX_CAPA      (SIZE_MAX / (int)sizeof(ENTRY))
-#define DHEAP_CAPA_INCR_MAX (10 * 1024 * 1024 / (int)sizeof(ENTRY))
+#include "d_heap.h"
 
-static ID id_cmp;    // <=>
-static ID id_abs;    // abs
-static ID id_lshift; // <<
-static ID id_uminus; // -@
+static ID id_cmp;       // <=>
+static ID id_abs;       // abs
+static ID id_lshift;    // <<
+static ID id_uminus;    // -@
+static ID id_auto;      // :auto
+static ID id_flat;      // :flat
+static ID id_paged;     // :paged
+static ID id_clock;     // clock:
+static ID id_monotonic; // :monotonic
+static ID id_realtime;  // :realtime
 
 static const rb_data_type_t dheap_data_type;
 
-/********************************************************************
- *
- * Metaprogramming macros
- *
- ********************************************************************/
-
-#define LIKELY   RB_LIKELY
-#define UNLIKELY RB_UNLIKELY
-
-#ifdef DHEAP_MAP
-#    define DHEAP_DISPATCH_EXPR(func, heap, ...)                               \
-        (DHEAPMAP_P(heap) ? dheapmap_##func(heap, __VA_ARGS__)                 \
-                          : dheap_##func(heap, __VA_ARGS__))
-#else
-#    define DHEAP_DISPATCH_EXPR(func, heap, ...)                               \
-        dheap_##func(heap, __VA_ARGS__);
-#endif
-
-#ifdef DHEAP_MAP
-#    define DHEAP_DISPATCH_STMT(heap, macro, ...)                              \
-        do {                                                                   \
-            if (DHEAPMAP_P(heap)) {                                            \
-                macro(dheapmap, heap, __VA_ARGS__);                            \
-            } else {                                                           \
-                macro(dheap, heap, __VA_ARGS__);                               \
-            }                                                                  \
-        } while (0)
-#else
-#    define DHEAP_DISPATCH_STMT(heap, macro, ...)                              \
-        macro(dheap, heap, __VA_ARGS__)
-#endif
-
-/********************************************************************
- *
- * SCORE: casting to and from VALUE
- *    adapted from similar methods in ruby's object.c
- *
- ********************************************************************/
-
-#define SCORE2NUM(score) rb_float_new(score)
-#define VAL2SCORE(val)   NUM2DBL(RB_FLOAT_TYPE_P(val) ? val : rb_Float(val))
-#define CMP_LT(a, b)     ((a) < (b))
-#define CMP_LTE(a, b)    ((a) <= (b))
-
-/********************************************************************
- *
- * DHeap ENTRY accessors
- *
- ********************************************************************/
-
-#define DHEAP_SCORE(heap, idx) (DHEAP_GET(heap, idx).score)
-#define DHEAP_VALUE(heap, idx) (DHEAP_GET(heap, idx).value)
-
-#define DHEAP_ENTRY_ARY(heap, idx)                                             \
-    (((heap)->size <= (idx))                                                   \
-       ? Qnil                                                                  \
-       : rb_ary_new_from_args(                                                 \
-           2, DHEAP_VALUE(heap, idx), SCORE2NUM(DHEAP_SCORE(heap, idx))))
-
-#define DHEAP_GET(heap, idx) ((heap)->entries[idx])
-#define DHEAP_SET(T, heap, index, entry)                                       \
-    do {                                                                       \
-        DHEAP_GET(heap, index) = (entry);                                      \
-        DHEAP_SET_##T(heap, index, entry);                                     \
-    } while (0)
-
-#define DHEAP_SET_dheap(heap, index, entry) /* noop */
-
-#ifdef DHEAP_MAP
-#    define DHEAP_SET_dheapmap(heap, index, entry)                             \
-        rb_hash_aset((heap)->indexes, (entry).value, ULONG2NUM(index))
-#endif
-
-/********************************************************************
- *
- * DHeap index math
- *
- ********************************************************************/
-
-#define DHEAP_IDX_LAST(heap)         ((heap)->size - 1)
-#define DHEAP_IDX_PARENT(heap, idx)  (((idx)-1) / (heap)->d)
-#define DHEAP_IDX_CHILD_0(heap, idx) (((idx) * (heap)->d) + 1)
-#define DHEAP_IDX_CHILD_D(heap, idx) (((idx) * (heap)->d) + (heap)->d)
-
-#ifdef DEBUG
-#    define ASSERT_DHEAP_IDX_OK(heap, index)                                   \
-        do {                                                                   \
-            if (DHEAP_IDX_LAST(heap) < index) {                                \
-                rb_raise(rb_eIndexError, "DHeap index %ld too large", index);  \
-            }                                                                  \
-        } while (0)
-#else
-#    define ASSERT_DHEAP_IDX_OK(heap, index)
-#endif
-
 /********************************************************************
  *
  * rb_data_type_t definitions
@@ -208,20 +72,43 @@ dheap_mark(void *ptr)
 #endif
 }
 
+// Frees the entries, unless they're still shared with a copy.
+static void
+dheap_release_entries(dheap_t *heap)
+{
+    if (heap->shared) {
+        if (!--*heap->shared) {
+            xfree(heap->shared);
+            xfree(heap->entries);
+        }
+        heap->shared = NULL;
+    } else if (heap->entries) {
+        xfree(heap->entries);
+    }
+    heap->entries = NULL;
+    heap->capa    = 0;
+}
+
 static void
 dheap_free(void *ptr)
 {
     dheap_t *heap = ptr;
     heap->size    = 0;
-    if (heap->entries) {
-        xfree(heap->entries);
-        heap->entries = NULL;
+    dheap_release_entries(heap);
+    if (heap->autod) {
+        xfree(heap->autod);
+        heap->autod = NULL;
     }
-    heap->capa = 0;
-    xfree(ptr);
+#ifdef DHEAP_STATS
+    if (heap->stats) {
+        xfree(heap->stats);
+        heap->stats = NULL;
+    }
+#endif
 #ifdef DHEAP_MAP
     heap->indexes = Qnil;
 #endif
+    xfree(ptr);
 }
 
 static size_t
@@ -230,7 +117,11 @@ dheap_memsize(const void *ptr)
     const dheap_t *heap = ptr;
     size_t         size = 0;
     size += sizeof(*heap);
-    size += sizeof(ENTRY) * heap->capa;
+    size += sizeof(ENTRY) * heap->capa / (heap->shared ? *heap->shared : 1);
+    if (heap->autod) size += sizeof(dheap_auto_t);
+#ifdef DHEAP_STATS
+    if (heap->stats) size += sizeof(dheap_stats_t);
+#endif
     return size;
 }
 
@@ -274,17 +165,64 @@ dheap_s_alloc(VALUE klass)
     // TypedData_Make_Struct uses a non-std "statement expression"
     obj = TypedData_Make_Struct(klass, dheap_t, &dheap_data_type, heap);
 #pragma GCC diagnostic pop
-    heap->d       = DHEAP_DEFAULT_D;
-    heap->size    = 0;
-    heap->capa    = 0;
-    heap->entries = NULL;
+    heap->d           = DHEAP_DEFAULT_D;
+    heap->buffering   = 0;
+    heap->size        = 0;
+    heap->capa        = 0;
+    heap->unsorted    = 0;
+    heap->page_nodes  = 0;
+    heap->page_leaves = 0;
+    heap->entries     = NULL;
+    heap->shared      = NULL;
+    heap->transforms  = 0;
+    heap->scale       = 1.0;
+    heap->offset      = 0.0;
+    heap->autod       = NULL;
 #ifdef DHEAP_MAP
     heap->indexes = Qnil;
 #endif
+#ifdef DHEAP_STATS
+    heap->stats = NULL;
+#endif
 
     return obj;
 }
 
+/*
+ * Copies entries (and DHeap::Map indexes) that are shared with a copy, before
+ * they are modified.  Everything is allocated before anything is released, so
+ * a failed allocation leaves the heap still sharing.
+ */
+static void
+dheap_unshare(dheap_t *heap)
+{
+    ENTRY *entries;
+#ifdef DHEAP_MAP
+    VALUE indexes = heap->indexes;
+#endif
+    if (*heap->shared == 1) { // every copy has already been freed or unshared
+        xfree(heap->shared);
+        heap->shared = NULL;
+        return;
+    }
+#ifdef DHEAP_MAP
+    if (DHEAPMAP_P(heap)) indexes = rb_hash_dup(heap->indexes);
+#endif
+    entries = ALLOC_N(ENTRY, heap->capa);
+    MEMCPY(entries, heap->entries, ENTRY, heap->size);
+    --*heap->shared;
+    heap->shared  = NULL;
+    heap->entries = entries;
+#ifdef DHEAP_MAP
+    heap->indexes = indexes;
+#endif
+}
+
+#define DHEAP_UNSHARE(heap)                                                    \
+    do {                                                                       \
+        if (UNLIKELY((heap)->shared)) dheap_unshare(heap);                     \
+    } while (0)
+
 static inline dheap_t *
 get_dheap_struct(VALUE self)
 {
@@ -293,11 +231,15 @@ get_dheap_struct(VALUE self)
     return heap;
 }
 
+// Also unshares the entries, for any method that might modify them.
 static inline dheap_t *
 get_dheap_struct_unfrozen(VALUE self)
 {
+    dheap_t *heap;
     rb_check_frozen(self);
-    return get_dheap_struct(self);
+    heap = get_dheap_struct(self);
+    DHEAP_UNSHARE(heap);
+    return heap;
 }
 
 void
@@ -309,6 +251,8 @@ dheap_set_capa(dheap_t *heap, size_t new_capa)
     // allocate
     if (heap->entries) {
         RB_REALLOC_N(heap->entries, ENTRY, new_capa);
+        DHEAP_STAT_ADD(heap, capa_growths, 1);
+        DHEAP_STAT_ADD(heap, realloc_bytes, sizeof(ENTRY) * new_capa);
     } else {
         heap->entries = RB_ZALLOC_N(ENTRY, new_capa);
     }
@@ -352,7 +296,9 @@ dheap_ensure_room_for_push(dheap_t *heap, size_t incr_by)
 static inline int
 dheap_value_to_int_d(VALUE num)
 {
-    int d = NUM2INT(num);
+    int d;
+    if (SYMBOL_P(num) && SYM2ID(num) == id_auto) return DHEAP_DEFAULT_D;
+    d = NUM2INT(num);
     if (d < 2) rb_raise(rb_eArgError, "DHeap d=%u is too small", d);
     if (d > DHEAP_MAX_D) rb_raise(rb_eArgError, "DHeap d=%u is too large", d);
     return d;
@@ -378,6 +324,10 @@ dheap_init(VALUE self, VALUE d, VALUE capa, VALUE map)
 
     heap->d = dheap_value_to_int_d(d);
     dheap_set_capa(heap, dheap_value_to_capa(capa));
+    if (SYMBOL_P(d)) {
+        heap->autod         = ZALLOC(dheap_auto_t);
+        heap->autod->window = DHEAP_AUTO_MIN_WINDOW;
+    }
 #ifdef DHEAP_MAP
     if (RTEST(map)) heap->indexes = rb_hash_new();
 #endif
@@ -391,76 +341,47 @@ dheap_initialize_copy(VALUE copy, VALUE orig)
 {
     dheap_t *heap_copy = get_dheap_struct_unfrozen(copy);
     dheap_t *heap_orig = get_dheap_struct(orig);
+    if (heap_copy == heap_orig) return copy;
+
+    heap_copy->d           = heap_orig->d;
+    heap_copy->buffering   = heap_orig->buffering;
+    heap_copy->unsorted    = heap_orig->unsorted;
+    heap_copy->page_nodes  = heap_orig->page_nodes;
+    heap_copy->page_leaves = heap_orig->page_leaves;
+    heap_copy->transforms  = heap_orig->transforms;
+    heap_copy->scale       = heap_orig->scale;
+    heap_copy->offset      = heap_orig->offset;
+    if (heap_orig->autod) {
+        if (!heap_copy->autod) heap_copy->autod = ALLOC(dheap_auto_t);
+        MEMCPY(heap_copy->autod, heap_orig->autod, dheap_auto_t, 1);
+    }
 
-    heap_copy->d = heap_orig->d;
-
-    dheap_set_capa(heap_copy, heap_orig->capa);
+    // copy-on-write:  the entries are shared until either heap modifies them
+    dheap_release_entries(heap_copy);
+    if (heap_orig->entries) {
+        if (!heap_orig->shared) {
+            heap_orig->shared  = ALLOC(size_t);
+            *heap_orig->shared = 1;
+        }
+        ++*heap_orig->shared;
+        heap_copy->shared  = heap_orig->shared;
+        heap_copy->entries = heap_orig->entries;
+        heap_copy->capa    = heap_orig->capa;
+    }
     heap_copy->size = heap_orig->size;
-    if (heap_copy->size)
-        MEMCPY(heap_copy->entries, heap_orig->entries, ENTRY, heap_orig->size);
 #ifdef DHEAP_MAP
-    if (RTEST(heap_orig->indexes))
-        heap_copy->indexes = rb_hash_dup(heap_orig->indexes);
+    heap_copy->indexes = heap_orig->indexes;
+#endif
+#ifdef DHEAP_STATS
+    if (heap_orig->stats) {
+        if (!heap_copy->stats) heap_copy->stats = ALLOC(dheap_stats_t);
+        MEMCPY(heap_copy->stats, heap_orig->stats, dheap_stats_t, 1);
+    }
 #endif
 
     return copy;
 }
 
-/********************************************************************
- *
- * DHeap sift up/down
- *
- ********************************************************************/
-
-#define DHEAP_SIFT_UP(T, heap, i)                                              \
-    do {                                                                       \
-        size_t sift_idx = i;                                                   \
-        ENTRY  entry    = DHEAP_GET(heap, sift_idx);                           \
-        ASSERT_DHEAP_IDX_OK(heap, sift_idx);                                   \
-        for (size_t parent_idx; 0 < sift_idx; sift_idx = parent_idx) {         \
-            parent_idx = DHEAP_IDX_PARENT(heap, sift_idx);                     \
-            if (CMP_LTE(DHEAP_SCORE((heap), parent_idx), entry.score)) break;  \
-            DHEAP_SET(T, heap, sift_idx, DHEAP_GET(heap, parent_idx));         \
-        }                                                                      \
-        DHEAP_SET(T, heap, sift_idx, entry);                                   \
-    } while (0)
-
-static inline size_t
-dheap_min_child(dheap_t *heap, size_t parent, size_t last_index)
-{
-    size_t min_child = DHEAP_IDX_CHILD_0(heap, parent);
-    size_t last_sib  = DHEAP_IDX_CHILD_D(heap, parent);
-    if (UNLIKELY(last_index < last_sib)) last_sib = last_index;
-
-    for (size_t sibidx = min_child + 1; sibidx <= last_sib; ++sibidx) {
-        if (CMP_LT(DHEAP_SCORE(heap, sibidx), DHEAP_SCORE(heap, min_child))) {
-            min_child = sibidx;
-        }
-    }
-    return min_child;
-}
-
-#define DHEAP_CAN_SIFT_DOWN(heap, index, last_index)                           \
-    (LIKELY(1 <= last_index && index <= DHEAP_IDX_PARENT(heap, last_index)))
-
-#define DHEAP_SIFT_DOWN(T, heap, i)                                            \
-    do {                                                                       \
-        size_t sift_idx = i;                                                   \
-        size_t last_idx = DHEAP_IDX_LAST(heap);                                \
-        ASSERT_DHEAP_IDX_OK(heap, sift_idx);                                   \
-        if (DHEAP_CAN_SIFT_DOWN(heap, sift_idx, last_idx)) {                   \
-            ENTRY  entry       = heap->entries[sift_idx];                      \
-            size_t last_parent = DHEAP_IDX_PARENT(heap, last_idx);             \
-            while (sift_idx <= last_parent) {                                  \
-                size_t min_child = dheap_min_child(heap, sift_idx, last_idx);  \
-                if (CMP_LTE(entry.score, DHEAP_SCORE(heap, min_child))) break; \
-                DHEAP_SET(T, heap, sift_idx, (heap)->entries[min_child]);      \
-                sift_idx = min_child;                                          \
-            }                                                                  \
-            DHEAP_SET(T, heap, sift_idx, entry);                               \
-        }                                                                      \
-    } while (0)
-
 /********************************************************************
  *
  * DHeap attributes
@@ -490,6 +411,9 @@ dheap_empty_p(VALUE self)
 }
 
 /*
+ * When the heap was created with <tt>d: :auto</tt>, this is the d that is
+ * currently in use, which may change as the heap is used.
+ *
  * @return [Integer] the maximum number of children per parent
  */
 static VALUE
@@ -499,6 +423,219 @@ dheap_attr_d(VALUE self)
     return INT2FIX(heap->d);
 }
 
+/********************************************************************
+ *
+ * DHeap heapify and the insertion buffer
+ *
+ * With buffering enabled, pushes are simply appended to the end of entries,
+ * without any comparisons.  The last "unsorted" entries are folded into the
+ * heap before anything that needs heap order: peek, pop, rescore, etc.
+ *
+ ********************************************************************/
+
+// O(n), and also folds in any unsorted entries.
+static void
+dheap_heapify(dheap_t *heap)
+{
+    heap->unsorted = 0;
+#ifdef DHEAP_MAP
+    if (DHEAPMAP_P(heap)) {
+        if (DHEAP_PAGED_P(heap)) {
+            DHEAP_HEAPIFY(dheapmap_paged, heap);
+        } else {
+            DHEAP_HEAPIFY(dheapmap, heap);
+        }
+        return;
+    }
+#endif
+    if (DHEAP_PAGED_P(heap)) {
+        DHEAP_HEAPIFY(dheap_paged, heap);
+    } else {
+        DHEAP_HEAPIFY(dheap, heap);
+    }
+}
+
+#define DHEAP_FOLD(heap)                                                       \
+    do {                                                                       \
+        if (UNLIKELY((heap)->unsorted)) dheap_fold(heap);                      \
+    } while (0)
+
+#define DHEAP_FOLD_SIFT_UPS(T, heap, start)                                    \
+    for (size_t fold_idx = (start); fold_idx < (heap)->size; ++fold_idx) {     \
+        DHEAP_SIFT_UP(T, heap, fold_idx);                                      \
+    }
+
+// Returns the number of levels in the heap (at least one).
+static inline size_t
+dheap_levels(dheap_t *heap)
+{
+    size_t levels = 1;
+    for (size_t width = heap->d; width < heap->size; width *= heap->d) {
+        ++levels;
+        if (SIZE_MAX / heap->d < width) break;
+    }
+    return levels;
+}
+
+// Sifts up each unsorted entry, unless (in the worst case) that would take
+// more comparisons than heapifying the entire heap.
+static void
+dheap_fold(dheap_t *heap)
+{
+    DHEAP_UNSHARE(heap); // even for frozen heaps
+    if (heap->size / dheap_levels(heap) <= heap->unsorted) {
+        dheap_heapify(heap);
+        return;
+    }
+    DHEAP_DISPATCH_STMT(heap, DHEAP_FOLD_SIFT_UPS, heap->size - heap->unsorted);
+    heap->unsorted = 0;
+}
+
+/*
+ * @return [Boolean] if pushes are buffered
+ *
+ * @see #buffered=
+ */
+static VALUE
+dheap_buffered_p(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    return heap->buffering ? Qtrue : Qfalse;
+}
+
+/*
+ * Enables or disables buffered pushes.
+ *
+ * When enabled, pushes are appended to an unsorted buffer at the end of the
+ * heap in <b>O(1)</b>, without any comparisons.  The buffer is folded into the
+ * heap by the next method that needs the minimum value (e.g. #peek or #pop),
+ * by sifting up each buffered entry or, if that could be slower, by
+ * re-heapifying in <b>O(n)</b>.  This can speed up bursts of many pushes
+ * between pops, but it doesn't change the results of any method.
+ *
+ * Disabling buffering will immediately fold in any buffered entries.
+ *
+ * @param buffered [Boolean]
+ * @return [Boolean]
+ */
+static VALUE
+dheap_set_buffered(VALUE self, VALUE buffered)
+{
+    dheap_t *heap   = get_dheap_struct_unfrozen(self);
+    heap->buffering = RTEST(buffered);
+    if (!heap->buffering) DHEAP_FOLD(heap);
+    return buffered;
+}
+
+/********************************************************************
+ *
+ * DHeap layout: :paged
+ *
+ * See d_heap.h for the paged layout's index math.
+ *
+ ********************************************************************/
+
+/* @!visibility private */
+static VALUE
+dheap_init_layout(VALUE self, VALUE layout)
+{
+    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    ID       id   = SYMBOL_P(layout) ? SYM2ID(layout) : 0;
+    if (id == id_flat) {
+        heap->page_nodes = heap->page_leaves = 0;
+    } else if (id == id_paged) {
+        dheap_set_pages(heap);
+    } else {
+        rb_raise(rb_eArgError, "invalid DHeap layout: %+" PRIsVALUE, layout);
+    }
+    if (heap->size) dheap_heapify(heap);
+    return self;
+}
+
+/*
+ * @return [Symbol] +:flat+ or +:paged+
+ * @see #initialize
+ */
+static VALUE
+dheap_attr_layout(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    return ID2SYM(DHEAP_PAGED_P(heap) ? id_paged : id_flat);
+}
+
+/********************************************************************
+ *
+ * DHeap d: :auto
+ *
+ * Every push, pop, and rescore is counted.  At the end of each window, the
+ * comparisons for that window's operation mix and mean size are predicted for
+ * every d in 2..DHEAP_AUTO_MAX_D:
+ *
+ *     (pushes + rescores + pops * d) * log(n) / log(d)
+ *
+ * Sift-up does one comparison per level and sift-down does d per level.  If
+ * the best d would have saved more than both DHEAP_AUTO_MIN_GAIN and the cost
+ * of an O(n) heapify, the heap is rebuilt in place with that d.  Because the
+ * window is never smaller than the heap, rebuilds are amortized O(1) per op.
+ *
+ ********************************************************************/
+
+#define DHEAP_AUTO_TICK(heap, field)                                           \
+    do {                                                                       \
+        if (UNLIKELY((heap)->autod)) {                                         \
+            ++(heap)->autod->field;                                            \
+            dheap_auto_tick(heap);                                             \
+        }                                                                      \
+    } while (0)
+
+static inline double
+dheap_auto_cost(const dheap_auto_t *autod, double log_n, int d)
+{
+    double sift_ups = (double)autod->pushes + (double)autod->rescores;
+    return (sift_ups + (double)autod->pops * d) * log_n / log(d);
+}
+
+static int
+dheap_auto_choose_d(dheap_t *heap)
+{
+    dheap_auto_t *autod     = heap->autod;
+    double        mean_size = (double)autod->size_sum / (double)autod->ops;
+    double        log_n     = log(mean_size < 2.0 ? 2.0 : mean_size);
+    double        cur_cost  = dheap_auto_cost(autod, log_n, heap->d);
+    double        best_cost = cur_cost;
+    int           best_d    = heap->d;
+    for (int d = 2; d <= DHEAP_AUTO_MAX_D; ++d) {
+        double cost = dheap_auto_cost(autod, log_n, d);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_d    = d;
+        }
+    }
+    if (cur_cost - best_cost < cur_cost * DHEAP_AUTO_MIN_GAIN) return heap->d;
+    // floyd's heapify averages roughly n * d / (d - 1) comparisons
+    if (cur_cost - best_cost < (double)heap->size * best_d / (best_d - 1))
+        return heap->d;
+    return best_d;
+}
+
+static void
+dheap_auto_tick(dheap_t *heap)
+{
+    dheap_auto_t *autod = heap->autod;
+    int           d;
+    autod->size_sum += heap->size;
+    if (LIKELY(++autod->ops < autod->window)) return;
+    d = dheap_auto_choose_d(heap);
+    if (d != heap->d) {
+        heap->d = d;
+        if (DHEAP_PAGED_P(heap)) dheap_set_pages(heap);
+        dheap_heapify(heap);
+    }
+    MEMZERO(autod, dheap_auto_t, 1);
+    autod->window = DHEAP_AUTO_MIN_WINDOW < heap->size ? heap->size
+                                                       : DHEAP_AUTO_MIN_WINDOW;
+}
+
 /********************************************************************
  *
  * DHeap push
@@ -508,29 +645,50 @@ dheap_attr_d(VALUE self)
 #define DHEAP_PUSH(T, heap, entry)                                             \
     do {                                                                       \
         dheap_ensure_room_for_push(heap, 1);                                   \
+        DHEAP_STAT_ADD(heap, pushes, 1);                                       \
         DHEAP_SET(T, heap, (heap)->size, *(entry));                            \
         ++heap->size;                                                          \
-        DHEAP_SIFT_UP(T, heap, DHEAP_IDX_LAST(heap));                          \
+        if (UNLIKELY((heap)->buffering)) {                                     \
+            ++(heap)->unsorted;                                                \
+        } else {                                                               \
+            DHEAP_SIFT_UP(T, heap, DHEAP_IDX_LAST(heap));                      \
+        }                                                                      \
+        DHEAP_AUTO_TICK(heap, pushes);                                         \
     } while (0)
 
 static inline void
 dheap_push_entry(VALUE self, ENTRY *entry)
 {
     dheap_t *heap = get_dheap_struct_unfrozen(self);
-    DHEAP_PUSH(dheap, heap, entry);
+    entry->score  = DHEAP_SCORE_IN(heap, entry->score);
+    DHEAP_LAYOUT_STMT(dheap, heap, DHEAP_PUSH, entry);
 }
 
 #ifdef DHEAP_MAP
 static inline void
 dheapmap_update_entry(dheap_t *heap, size_t index, ENTRY *entry)
 {
-    SCORE prev = DHEAP_SCORE(heap, index);
+    SCORE prev;
+    if (UNLIKELY(heap->unsorted)) {
+        if (heap->size - heap->unsorted <= index) {
+            // it will be sifted when the unsorted entries are folded in
+            DHEAP_STAT_ADD(heap, rescores, 1);
+            DHEAP_SET(dheapmap, heap, index, *entry);
+            DHEAP_AUTO_TICK(heap, rescores);
+            return;
+        }
+        dheap_fold(heap); // which may move the entry
+        index = NUM2ULONG(rb_hash_lookup(heap->indexes, entry->value));
+    }
+    prev = DHEAP_SCORE(heap, index);
+    DHEAP_STAT_ADD(heap, rescores, 1);
     DHEAP_SET(dheapmap, heap, index, *entry);
     if (CMP_LT(prev, entry->score)) {
-        DHEAP_SIFT_DOWN(dheapmap, heap, index);
+        DHEAP_LAYOUT_STMT(dheapmap, heap, DHEAP_SIFT_DOWN, index);
     } else {
-        DHEAP_SIFT_UP(dheapmap, heap, index);
+        DHEAP_LAYOUT_STMT(dheapmap, heap, DHEAP_SIFT_UP, index);
     }
+    DHEAP_AUTO_TICK(heap, rescores);
 }
 
 static inline void
@@ -538,12 +696,14 @@ dheapmap_push_entry(VALUE self, ENTRY *entry)
 {
     dheap_t *heap   = get_dheap_struct_unfrozen(self);
     VALUE    idxval = rb_hash_lookup2(heap->indexes, entry->value, Qfalse);
+    DHEAP_STAT_ADD(heap, hash_ops, 1);
+    entry->score = DHEAP_SCORE_IN(heap, entry->score);
     if (idxval) {
         size_t index = NUM2ULONG(idxval);
         dheapmap_update_entry(heap, index, entry);
         return;
     }
-    DHEAP_PUSH(dheapmap, heap, entry);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, DHEAP_PUSH, entry);
 }
 #endif
 
@@ -665,10 +825,11 @@ dheapmap_lshift(VALUE self, VALUE value)
 #define PEEK_WITH_SCORE(heap)       DHEAP_ENTRY_ARY(heap, 0)
 #define PEEK_LT_P(heap, max_score)  _PEEK_CMP_P(heap, CMP_LT, max_score)
 #define PEEK_LTE_P(heap, max_score) _PEEK_CMP_P(heap, CMP_LTE, max_score)
+// Thresholds are compared in the output frame, just like #peek_score reports.
 #define _PEEK_CMP_P(heap, cmp, score)                                          \
-    ((!DHEAP_EMPTY_P(heap) && cmp(PEEK_SCORE(heap), (score)))                  \
-       ? PEEK_VALUE(heap)                                                      \
-       : 0)
+    (PEEK_FRAME_CMP_P(heap, DHEAP_SCORE_OUT, cmp, score) ? PEEK_VALUE(heap) : 0)
+#define PEEK_FRAME_CMP_P(heap, frame, cmp, score)                              \
+    (!DHEAP_EMPTY_P(heap) && cmp(frame(heap, PEEK_SCORE(heap)), (score)))
 
 /*
  * Returns the next value on the heap, and its score, without popping it
@@ -683,6 +844,7 @@ static VALUE
 dheap_peek_with_score(VALUE self)
 {
     dheap_t *heap = get_dheap_struct(self);
+    DHEAP_FOLD(heap);
     return PEEK_WITH_SCORE(heap);
 }
 
@@ -700,8 +862,9 @@ static VALUE
 dheap_peek_score(VALUE self)
 {
     dheap_t *heap = get_dheap_struct(self);
+    DHEAP_FOLD(heap);
     if (DHEAP_EMPTY_P(heap)) return Qnil;
-    return SCORE2NUM(PEEK_SCORE(heap));
+    return SCORE2NUM(DHEAP_SCORE_OUT(heap, PEEK_SCORE(heap)));
 }
 
 /*
@@ -717,6 +880,7 @@ static VALUE
 dheap_peek(VALUE self)
 {
     dheap_t *heap = get_dheap_struct(self);
+    DHEAP_FOLD(heap);
     if (DHEAP_EMPTY_P(heap)) return Qnil;
     return PEEK_VALUE(heap);
 }
@@ -727,17 +891,26 @@ dheap_peek(VALUE self)
 
 #define DHEAP_DELETE_0(T, heap)                                                \
     do {                                                                       \
+        DHEAP_STAT_ADD(heap, pops, 1);                                         \
         _DELETE_ENTRY(T, heap, 0);                                             \
         if (0 < --(heap)->size) {                                              \
             DHEAP_SET(T, (heap), 0, (heap)->entries[(heap)->size]);            \
             DHEAP_SIFT_DOWN(T, (heap), 0);                                     \
+        } else {                                                               \
+            DHEAP_STAT_DEPTH(heap, sift_down_depths, 0);                       \
         }                                                                      \
+        DHEAP_AUTO_TICK(heap, pops);                                           \
     } while (0)
 
 #define _DELETE_ENTRY(T, heap, idx)    _DELETE_ENTRY_##T(heap, idx)
 #define _DELETE_ENTRY_dheap(heap, idx) /* noop */
+#define _DELETE_ENTRY_dheap_paged      _DELETE_ENTRY_dheap
+#define _DELETE_ENTRY_dheapmap_paged   _DELETE_ENTRY_dheapmap
 #define _DELETE_ENTRY_dheapmap(heap, idx)                                      \
-    rb_hash_delete(heap->indexes, DHEAP_VALUE(heap, idx))
+    do {                                                                       \
+        DHEAP_STAT_ADD(heap, hash_ops, 1);                                     \
+        rb_hash_delete(heap->indexes, DHEAP_VALUE(heap, idx));                 \
+    } while (0)
 
 #define POP(T, heap, popped)            _POP(T, VALUE, heap, popped)
 #define POP_WITH_SCORE(T, heap, popped) _POP(T, WITH_SCORE, heap, popped)
@@ -780,7 +953,8 @@ dheap_pop(VALUE self)
 {
     dheap_t *heap = get_dheap_struct_unfrozen(self);
     VALUE    popped;
-    POP(dheap, heap, &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP, &popped);
     return popped;
 }
 
@@ -791,7 +965,8 @@ dheapmap_pop(VALUE self)
 {
     dheap_t *heap = get_dheap_struct_unfrozen(self);
     VALUE    popped;
-    POP(dheapmap, heap, &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, POP, &popped);
     return popped;
 }
 #endif
@@ -811,7 +986,8 @@ dheap_pop_with_score(VALUE self)
 {
     dheap_t *heap = get_dheap_struct_unfrozen(self);
     VALUE    popped;
-    POP_WITH_SCORE(dheap, heap, &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_WITH_SCORE, &popped);
     return popped;
 }
 
@@ -822,7 +998,8 @@ dheapmap_pop_with_score(VALUE self)
 {
     dheap_t *heap = get_dheap_struct_unfrozen(self);
     VALUE    popped;
-    POP_WITH_SCORE(dheapmap, heap, &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, POP_WITH_SCORE, &popped);
     return popped;
 }
 #endif
@@ -847,9 +1024,11 @@ dheapmap_pop_with_score(VALUE self)
 static VALUE
 dheap_pop_lte(VALUE self, VALUE max_score)
 {
-    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = VAL2SCORE(max_score);
     VALUE    popped;
-    POP_LTE(dheap, heap, VAL2SCORE(max_score), &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_LTE, score, &popped);
     return popped;
 }
 
@@ -858,9 +1037,11 @@ dheap_pop_lte(VALUE self, VALUE max_score)
 static VALUE
 dheapmap_pop_lte(VALUE self, VALUE max_score)
 {
-    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = VAL2SCORE(max_score);
     VALUE    popped;
-    POP_LTE(dheapmap, heap, VAL2SCORE(max_score), &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, POP_LTE, score, &popped);
     return popped;
 }
 #endif
@@ -882,9 +1063,11 @@ dheapmap_pop_lte(VALUE self, VALUE max_score)
 static VALUE
 dheap_pop_lt(VALUE self, VALUE max_score)
 {
-    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = VAL2SCORE(max_score);
     VALUE    popped;
-    POP_LT(dheap, heap, VAL2SCORE(max_score), &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_LT, score, &popped);
     return popped;
 }
 
@@ -893,26 +1076,37 @@ dheap_pop_lt(VALUE self, VALUE max_score)
 static VALUE
 dheapmap_pop_lt(VALUE self, VALUE max_score)
 {
-    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = VAL2SCORE(max_score);
     VALUE    popped;
-    POP_LT(dheapmap, heap, VAL2SCORE(max_score), &popped);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, POP_LT, score, &popped);
     return popped;
 }
 #endif
 
+// receiver#<< may transform the heap, so only arrays use a hoisted frame.
 #define POP_ALL_BELOW(T, heap, max_score, array)                               \
+    POP_ALL_CMP(T, heap, CMP_LT, max_score, array)
+#define POP_ALL_CMP(T, heap, cmp, max_score, array)                            \
     do {                                                                       \
-        VALUE val = Qnil;                                                      \
-        if (RB_TYPE_P(array, T_ARRAY)) {                                       \
-            while ((val = PEEK_LT_P(heap, max_score))) {                       \
-                DHEAP_DELETE_0(T, heap);                                       \
-                rb_ary_push(array, val);                                       \
-            }                                                                  \
+        if (!RB_TYPE_P(array, T_ARRAY)) {                                      \
+            POP_ALL_FRAME_CMP(T, heap, DHEAP_SCORE_OUT, cmp, max_score,        \
+                              rb_funcall(array, id_lshift, 1, val));           \
+        } else if (UNLIKELY((heap)->transforms)) {                             \
+            POP_ALL_FRAME_CMP(T, heap, DHEAP_SCORE_OUT_XF, cmp, max_score,     \
+                              rb_ary_push(array, val));                        \
         } else {                                                               \
-            while ((val = PEEK_LT_P(heap, max_score))) {                       \
-                DHEAP_DELETE_0(T, heap);                                       \
-                rb_funcall(array, id_lshift, 1, val);                          \
-            }                                                                  \
+            POP_ALL_FRAME_CMP(T, heap, DHEAP_SCORE_RAW, cmp, max_score,        \
+                              rb_ary_push(array, val));                        \
+        }                                                                      \
+    } while (0)
+#define POP_ALL_FRAME_CMP(T, heap, frame, cmp, max_score, push_val)            \
+    do {                                                                       \
+        while (PEEK_FRAME_CMP_P(heap, frame, cmp, max_score)) {                \
+            VALUE val = PEEK_VALUE(heap);                                      \
+            DHEAP_DELETE_0(T, heap);                                           \
+            push_val;                                                          \
         }                                                                      \
     } while (0)
 
@@ -936,92 +1130,1426 @@ static VALUE
 dheap_pop_all_below(int argc, VALUE *argv, VALUE self)
 {
     dheap_t *heap      = get_dheap_struct_unfrozen(self);
-    SCORE    max_score = (argc) ? VAL2SCORE(argv[0]) : 0.0;
+    SCORE    max_score = argc ? VAL2SCORE(argv[0]) : 0;
     VALUE    array     = (argc == 1) ? rb_ary_new() : argv[1];
     rb_check_arity(argc, 1, 2);
+    DHEAP_FOLD(heap);
     DHEAP_DISPATCH_STMT(heap, POP_ALL_BELOW, max_score, array);
     return array;
 }
 
 /********************************************************************
  *
- * DHeap, misc methods
+ * DHeap, fused push and pop
+ *
+ * Like python's heapq.heappushpop and heapq.heapreplace:  a single sift-down,
+ * instead of a sift-up followed by a sift-down.
  *
  ********************************************************************/
 
-static VALUE
+#define DHEAP_REPLACE_0(T, heap, entry)                                        \
+    do {                                                                       \
+        DHEAP_STAT_ADD(heap, pushes, 1);                                       \
+        DHEAP_STAT_ADD(heap, pops, 1);                                         \
+        _DELETE_ENTRY(T, heap, 0);                                             \
+        DHEAP_SET(T, heap, 0, entry);                                          \
+        DHEAP_SIFT_DOWN(T, heap, 0);                                           \
+        DHEAP_AUTO_TICK(heap, pushes);                                         \
+        DHEAP_AUTO_TICK(heap, pops);                                           \
+    } while (0)
+
+// When the pushed entry would be popped right back, the heap isn't touched.
+#define PUSH_POP(T, heap, entry, popped)                                       \
+    do {                                                                       \
+        if (DHEAP_EMPTY_P(heap) || CMP_LTE((entry).score, PEEK_SCORE(heap))) { \
+            DHEAP_STAT_ADD(heap, pushes, 1);                                   \
+            DHEAP_STAT_ADD(heap, pops, 1);                                     \
+            *(popped) = (entry).value;                                         \
+        } else {                                                               \
+            *(popped) = PEEK_VALUE(heap);                                      \
+            DHEAP_REPLACE_0(T, heap, entry);                                   \
+        }                                                                      \
+    } while (0)
+
+#define REPLACE_TOP(T, heap, entry, popped)                                    \
+    do {                                                                       \
+        if (DHEAP_EMPTY_P(heap)) {                                             \
+            *(popped) = Qnil;                                                  \
+            DHEAP_PUSH(T, heap, &(entry));                                     \
+        } else {                                                               \
+            *(popped) = PEEK_VALUE(heap);                                      \
+            DHEAP_REPLACE_0(T, heap, entry);                                   \
+        }                                                                      \
+    } while (0)
+
+/*
+ * @overload push_pop(value, score = value)
+ *
+ * Pushes a value and then pops the minimum value, in a single sift-down.  When
+ * the pushed score is less than or equal to the minimum score, the pushed
+ * value is returned immediately, without modifying the heap.
+ *
+ * Equivalent to <tt>push(value, score).pop</tt>, but faster.
+ *
+ * Time complexity: <b>O(d log n / log d)</b> <i>(worst-case)</i>
+ *
+ * @param value [Object] an object that is associated with the score.
+ * @param score [Integer,Float,#to_f] a score to compare against other scores.
+ *
+ * @return [Object] the value with the minimum score, which may be +value+
+ *
+ * @see #replace_top
+ */
+static VALUE
+dheap_push_pop(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    entry.score = DHEAP_SCORE_IN(heap, entry.score);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, PUSH_POP, entry, &popped);
+    return popped;
+}
+
+#ifdef DHEAP_MAP
+/*
+ * (see DHeap#push_pop)
+ *
+ * If +value+ is already a member, it is rescored before popping.
+ */
+static VALUE
+dheapmap_push_pop(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    DHEAP_STAT_ADD(heap, hash_ops, 1);
+    if (RTEST(rb_hash_lookup2(heap->indexes, entry.value, Qfalse))) {
+        dheapmap_push_entry(self, &entry);
+        DHEAP_FOLD(heap);
+        DHEAP_LAYOUT_STMT(dheapmap, heap, POP, &popped);
+        return popped;
+    }
+    entry.score = DHEAP_SCORE_IN(heap, entry.score);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, PUSH_POP, entry, &popped);
+    return popped;
+}
+#endif
+
+/*
+ * @overload replace_top(value, score = value)
+ *
+ * Pops the minimum value and then pushes a value, in a single sift-down.
+ * Unlike #push_pop, the pushed value is never returned, even if its score is
+ * less than the popped score.
+ *
+ * Equivalent to <tt>pop.tap { push(value, score) }</tt>, but faster.
+ *
+ * Time complexity: <b>O(d log n / log d)</b> <i>(worst-case)</i>
+ *
+ * @param value [Object] an object that is associated with the score.
+ * @param score [Integer,Float,#to_f] a score to compare against other scores.
+ *
+ * @return [Object] the value with the minimum score, or nil if the heap was
+ *                  empty
+ *
+ * @see #push_pop
+ */
+static VALUE
+dheap_replace_top(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    entry.score = DHEAP_SCORE_IN(heap, entry.score);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, REPLACE_TOP, entry, &popped);
+    return popped;
+}
+
+#ifdef DHEAP_MAP
+/*
+ * (see DHeap#replace_top)
+ *
+ * If +value+ is already a member, it is rescored after popping.
+ */
+static VALUE
+dheapmap_replace_top(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    DHEAP_STAT_ADD(heap, hash_ops, 1);
+    DHEAP_FOLD(heap);
+    if (RTEST(rb_hash_lookup2(heap->indexes, entry.value, Qfalse))) {
+        DHEAP_LAYOUT_STMT(dheapmap, heap, POP, &popped);
+        dheapmap_push_entry(self, &entry);
+        return popped;
+    }
+    entry.score = DHEAP_SCORE_IN(heap, entry.score);
+    DHEAP_LAYOUT_STMT(dheapmap, heap, REPLACE_TOP, entry, &popped);
+    return popped;
+}
+#endif
+
+/********************************************************************
+ *
+ * DHeap, clock-aware expiry
+ *
+ * For timer queues scored by clock time, the clock is read directly with
+ * clock_gettime, without any ruby method calls or Float allocations.
+ *
+ ********************************************************************/
+
+static clockid_t
+dheap_value_to_clockid(VALUE clock)
+{
+    if (clock == Qundef) return CLOCK_MONOTONIC;
+    if (SYMBOL_P(clock)) {
+        ID id = SYM2ID(clock);
+        if (id == id_monotonic) return CLOCK_MONOTONIC;
+        if (id == id_realtime) return CLOCK_REALTIME;
+    } else if (RB_INTEGER_TYPE_P(clock)) {
+        return (clockid_t)NUM2INT(clock); // e.g. Process::CLOCK_BOOTTIME
+    }
+    rb_raise(rb_eArgError, "unknown clock: %+" PRIsVALUE, clock);
+}
+
+static SCORE
+dheap_clock_gettime(VALUE clock)
+{
+    struct timespec ts;
+    if (clock_gettime(dheap_value_to_clockid(clock), &ts) != 0) {
+        rb_sys_fail("clock_gettime");
+    }
+    return (SCORE)ts.tv_sec + (SCORE)ts.tv_nsec / 1e9;
+}
+
+/* @!visibility private */
+static VALUE
+dheap_clock_now(VALUE self, VALUE clock)
+{
+    return SCORE2NUM(dheap_clock_gettime(clock));
+}
+
+// Returns Qundef when "clock:" isn't given.
+static VALUE
+dheap_clock_kwarg(VALUE opts)
+{
+    VALUE clock = Qundef;
+    if (!NIL_P(opts)) rb_get_kwargs(opts, &id_clock, 0, 1, &clock);
+    return clock;
+}
+
+#define POP_ALL_DUE(T, heap, now, array)                                       \
+    POP_ALL_CMP(T, heap, CMP_LTE, now, array)
+
+/*
+ * @overload pop_due(receiver = [], clock: :monotonic)
+ *
+ * Pops every value that is due: with a score less than or equal to the
+ * current time of +clock+, in seconds.  This is equivalent to (but faster
+ * than):
+ *
+ *     now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+ *     heap.pop_all_below(now.next_float, receiver)
+ *
+ * Time complexity: <b>O(m * d log n / log d)</b>, <i>m = number popped</i>
+ *
+ * @param receiver [Array,#<<] object onto which the values will be pushed, in
+ *                             order by score.
+ * @param clock [:monotonic, :realtime, Integer] +:monotonic+ for scores from
+ *              <tt>Process.clock_gettime(Process::CLOCK_MONOTONIC)</tt>,
+ *              +:realtime+ for scores from <tt>Time#to_f</tt>, or any
+ *              <tt>Process::CLOCK_*</tt> clock id.
+ *
+ * @return [Object] the object onto which the values were pushed
+ *
+ * @see #next_timeout
+ * @see #pop_all_below
+ */
+static VALUE
+dheap_pop_due(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    VALUE    array, opts;
+    SCORE    now;
+    rb_scan_args(argc, argv, "01:", &array, &opts);
+    if (NIL_P(array)) array = rb_ary_new();
+    now = dheap_clock_gettime(dheap_clock_kwarg(opts));
+    DHEAP_FOLD(heap);
+    DHEAP_DISPATCH_STMT(heap, POP_ALL_DUE, now, array);
+    return array;
+}
+
+/*
+ * @overload next_timeout(clock: :monotonic)
+ *
+ * Returns the number of seconds until the minimum value is due (see
+ * #pop_due), e.g. for <tt>IO.select</tt> or a Fiber scheduler's timeout.
+ *
+ * @param clock [:monotonic, :realtime, Integer] see #pop_due
+ *
+ * @return [Float] seconds until the next value is due, or 0.0 if it's overdue
+ * @return [nil] if the heap is empty
+ *
+ * @see #pop_due
+ */
+static VALUE
+dheap_next_timeout(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    VALUE    opts;
+    SCORE    now, min;
+    rb_scan_args(argc, argv, "0:", &opts);
+    now = dheap_clock_gettime(dheap_clock_kwarg(opts));
+    DHEAP_FOLD(heap);
+    if (DHEAP_EMPTY_P(heap)) return Qnil;
+    min = DHEAP_SCORE_OUT(heap, PEEK_SCORE(heap));
+    if (CMP_LTE(min, now)) return SCORE2NUM(0.0);
+    return SCORE2NUM(min - now);
+}
+
+/********************************************************************
+ *
+ * DHeap, lazy score transforms
+ *
+ * A positive affine transform preserves the order of every score, so it can be
+ * applied lazily, in O(1):  scores are stored in a frame that lags behind the
+ * scores seen from ruby, and are only converted where they cross the ruby API
+ * (see DHEAP_SCORE_IN and DHEAP_SCORE_OUT).  Pending transforms are composed,
+ * and periodically materialized into the stored scores, in O(n), which also
+ * preserves their order (so nothing needs to be sifted).
+ *
+ * The two conversions don't exactly round-trip in floating point, so the
+ * thresholds for pop_lt, pop_all_below, pop_due, etc are compared with the
+ * minimum's converted score:  the same score that #peek_score returns.
+ *
+ ********************************************************************/
+
+static void
+dheap_materialize_scores(dheap_t *heap)
+{
+    DHEAP_UNSHARE(heap);
+    for (size_t i = 0; i < heap->size; ++i) {
+        DHEAP_SCORE(heap, i) = DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, i));
+    }
+    heap->transforms = 0;
+    heap->scale      = 1.0;
+    heap->offset     = 0.0;
+}
+
+// Every (signed) score becomes score * scale + offset.
+static VALUE
+dheap_transform_scores(VALUE self, SCORE scale, SCORE offset)
+{
+    dheap_t *heap;
+    rb_check_frozen(self);
+    heap = get_dheap_struct(self); // not unshared:  the entries aren't modified
+    if (DHEAP_EMPTY_P(heap)) {
+        heap->transforms = 0;
+        heap->scale      = 1.0;
+        heap->offset     = 0.0;
+        return self;
+    }
+    if (!heap->transforms) {
+        heap->scale  = 1.0;
+        heap->offset = 0.0;
+    }
+    heap->scale *= scale;
+    heap->offset = heap->offset * scale + offset;
+    ++heap->transforms;
+    if (DHEAP_MAX_TRANSFORMS <= heap->transforms ||
+        heap->scale < DHEAP_MIN_SCALE || DHEAP_MAX_SCALE < heap->scale) {
+        dheap_materialize_scores(heap);
+    }
+    return self;
+}
+
+static SCORE
+dheap_value_to_delta(VALUE delta)
+{
+    SCORE score = VAL2SCORE(delta);
+    if (!isfinite(score)) rb_raise(rb_eArgError, "delta must be finite");
+    return score;
+}
+
+static SCORE
+dheap_value_to_factor(VALUE factor)
+{
+    SCORE score = VAL2SCORE(factor);
+    if (!(0 < score && isfinite(score))) {
+        rb_raise(rb_eArgError, "factor must be positive and finite");
+    }
+    return score;
+}
+
+/*
+ * Adds +delta+ to every score.  The order of the heap isn't changed, so the
+ * scores are only adjusted lazily, as they are read.  Scores that are pushed
+ * afterwards aren't affected.
+ *
+ * Because scores are converted with floating point arithmetic, scores that are
+ * pushed after a transform may be read back rounded, by a few ULPs.
+ *
+ * Time complexity: <b>O(1)</b> <i>(amortized)</i>
+ *
+ * @param delta [Integer,Float,#to_f] added to every score
+ * @return [self]
+ *
+ * @see #scale_scores!
+ */
+static VALUE
+dheap_shift_scores(VALUE self, VALUE delta)
+{
+    return dheap_transform_scores(self, 1.0, dheap_value_to_delta(delta));
+}
+
+/*
+ * Multiplies every score by a positive +factor+.  The order of the heap isn't
+ * changed, so the scores are only adjusted lazily, as they are read.  Scores
+ * that are pushed afterwards aren't affected.
+ *
+ * Time complexity: <b>O(1)</b> <i>(amortized)</i>
+ *
+ * @param factor [Integer,Float,#to_f] a positive, finite number
+ * @return [self]
+ *
+ * @see #shift_scores!
+ */
+static VALUE
+dheap_scale_scores(VALUE self, VALUE factor)
+{
+    return dheap_transform_scores(self, dheap_value_to_factor(factor), 0.0);
+}
+
+/*
+ * Converts a score into the stored frame, for DHeap::Trace.
+ *
+ * @!visibility private
+ */
+static VALUE
+dheap_stored_score(VALUE self, VALUE score)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    return SCORE2NUM(DHEAP_SCORE_IN(heap, VAL2SCORE(score)));
+}
+
+/********************************************************************
+ *
+ * DHeap, misc methods
+ *
+ ********************************************************************/
+
+static VALUE
 dheap_to_a(VALUE self)
 {
-    dheap_t *heap  = get_dheap_struct(self);
-    VALUE    array = rb_ary_new_capa(heap->size);
-    for (size_t i = 0; i < heap->size; i++) {
-        rb_ary_push(array, DHEAP_ENTRY_ARY(heap, i));
+    dheap_t *heap  = get_dheap_struct(self);
+    VALUE    array = rb_ary_new_capa(heap->size);
+    DHEAP_FOLD(heap);
+    for (size_t i = 0; i < heap->size; i++) {
+        rb_ary_push(array, DHEAP_ENTRY_ARY(heap, i));
+    }
+    return array;
+}
+
+/*
+ * Returns every score, in heap order, as a String of packed native doubles:
+ * the same format as <tt>scores.pack("D*")</tt>.  Unlike #to_a, no objects are
+ * allocated per entry.  For a read-only IO::Buffer view of the scores, use
+ * <tt>IO::Buffer.for(heap.scores_buffer)</tt>.
+ *
+ * Time complexity: <b>O(n)</b>
+ *
+ * @return [String] a binary String of <tt>size * 8</tt> bytes
+ *
+ * @see #values
+ * @see DHeap.from_buffer
+ */
+static VALUE
+dheap_scores_buffer(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    VALUE    str;
+    char    *ptr;
+    DHEAP_FOLD(heap);
+    str = rb_str_new(NULL, heap->size * sizeof(SCORE));
+    ptr = RSTRING_PTR(str);
+    for (size_t i = 0; i < heap->size; ++i) {
+        SCORE score = DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, i));
+        memcpy(ptr + i * sizeof(SCORE), &score, sizeof(SCORE));
+    }
+    return str;
+}
+
+/*
+ * Returns every value, in heap order:  the same order as #scores_buffer.
+ *
+ * Time complexity: <b>O(n)</b>
+ *
+ * @return [Array<Object>]
+ *
+ * @see #scores_buffer
+ */
+static VALUE
+dheap_values(VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct(self);
+    VALUE    array = rb_ary_new_capa(heap->size);
+    DHEAP_FOLD(heap);
+    for (size_t i = 0; i < heap->size; ++i) {
+        rb_ary_push(array, DHEAP_VALUE(heap, i));
+    }
+    return array;
+}
+
+static int
+dheap_value_to_threads(VALUE num)
+{
+    int threads = NUM2INT(num);
+    if (threads < 1) rb_raise(rb_eArgError, "threads=%d is too small", threads);
+    return threads < DHEAP_MAX_THREADS ? threads : DHEAP_MAX_THREADS;
+}
+
+// Copies scores (packed doubles, or an Array of Numerics) times sign into
+// scratch entries, whose values are their indexes.
+static void
+dheap_load_scores(ENTRY *buf, VALUE scores, long len, SCORE sign)
+{
+    for (long i = 0; i < len; ++i) {
+        if (RB_TYPE_P(scores, T_ARRAY)) {
+            buf[i].score = VAL2SCORE(RARRAY_AREF(scores, i));
+        } else {
+            memcpy(&buf[i].score,
+                   RSTRING_PTR(scores) + i * sizeof(SCORE),
+                   sizeof(SCORE));
+        }
+        buf[i].score *= sign;
+        buf[i].value = i;
+    }
+}
+
+struct dheap_load
+{
+    VALUE  self;
+    VALUE  values; // nil when the scores are also the values
+    ENTRY *buf;
+    long   len;
+    SCORE  sign;
+    int    buffering; // the caller's setting, restored afterwards
+};
+
+static VALUE
+dheap_load_pushes(VALUE ptr)
+{
+    struct dheap_load *load = (struct dheap_load *)ptr;
+    for (long i = 0; i < load->len; ++i) {
+        ENTRY entry;
+        entry.score = load->buf[i].score;
+        entry.value = NIL_P(load->values)
+                        ? SCORE2NUM(load->sign * load->buf[i].score)
+                        : RARRAY_AREF(load->values, i);
+#ifdef DHEAP_MAP
+        if (DHEAPMAP_P(get_dheap_struct(load->self))) {
+            dheapmap_push_entry(load->self, &entry);
+            continue;
+        }
+#endif
+        dheap_push_entry(load->self, &entry);
+    }
+    return Qnil;
+}
+
+// Always runs after the pushes (even when #hash or #eql? raised), so the heap
+// isn't left buffering when the caller wasn't.
+static VALUE
+dheap_load_fold(VALUE ptr)
+{
+    struct dheap_load *load = (struct dheap_load *)ptr;
+    dheap_t           *heap = get_dheap_struct(load->self);
+    heap->buffering         = load->buffering;
+    if (!heap->buffering) DHEAP_FOLD(heap);
+    return Qnil;
+}
+
+// Appends scores (times sign) and their values without sifting, then heapifies
+// once:  O(n).  When values is nil, the scores are also the values.
+// DHeap::Map duplicates are rescored, as with push.
+//
+// Large loads into an empty DHeap are heapified in scratch memory, without the
+// GVL, on up to threads threads.
+static VALUE
+dheap_load_signed(VALUE self,
+                  VALUE scores,
+                  VALUE values,
+                  VALUE threads_val,
+                  SCORE sign)
+{
+    dheap_t          *heap    = get_dheap_struct_unfrozen(self);
+    int               threads = dheap_value_to_threads(threads_val);
+    VALUE             bufv    = 0;
+    ENTRY            *buf;
+    long              len;
+    struct dheap_load load;
+    // snapshots, in case either is modified by another thread or by #hash
+    if (RB_TYPE_P(scores, T_ARRAY)) {
+        scores = rb_ary_dup(scores);
+        len    = RARRAY_LEN(scores);
+    } else {
+        StringValue(scores);
+        len = RSTRING_LEN(scores) / sizeof(SCORE);
+        if (RSTRING_LEN(scores) % sizeof(SCORE)) {
+            rb_raise(rb_eArgError,
+                     "packed String length %ld isn't a multiple of %zu",
+                     RSTRING_LEN(scores),
+                     sizeof(SCORE));
+        }
+    }
+    if (NIL_P(values) && RB_TYPE_P(scores, T_ARRAY)) {
+        values = scores;
+    } else if (!NIL_P(values)) {
+        Check_Type(values, T_ARRAY);
+        values = rb_ary_dup(values);
+        if (RARRAY_LEN(values) != len) {
+            rb_raise(rb_eArgError,
+                     "%ld scores for %ld values",
+                     len,
+                     RARRAY_LEN(values));
+        }
+    }
+    buf = ALLOCV_N(ENTRY, bufv, len);
+    dheap_load_scores(buf, scores, len, sign);
+#ifdef DHEAP_MAP
+    if (!DHEAPMAP_P(heap) && DHEAP_EMPTY_P(heap) && DHEAP_NOGVL_MIN_LOAD <= len)
+#else
+    if (DHEAP_EMPTY_P(heap) && DHEAP_NOGVL_MIN_LOAD <= len)
+#endif
+    {
+        dheap_t tmp = *heap;
+        tmp.size    = len;
+        tmp.capa    = len;
+        tmp.entries = buf;
+#ifdef DHEAP_STATS
+        tmp.stats = NULL;
+#endif
+        dheap_parallel_heapify(&tmp, threads);
+        // the heap may have been changed by another thread meanwhile
+        heap = get_dheap_struct_unfrozen(self);
+        dheap_ensure_room_for_push(heap, len);
+        DHEAP_STAT_ADD(heap, pushes, len);
+        if (!DHEAP_EMPTY_P(heap) || heap->d != tmp.d ||
+            heap->page_nodes != tmp.page_nodes) {
+            heap->unsorted += len;
+        }
+        for (long i = 0; i < len; ++i) {
+            ENTRY *entry = &heap->entries[heap->size];
+            entry->value = NIL_P(values) ? SCORE2NUM(sign * buf[i].score)
+                                         : RARRAY_AREF(values, buf[i].value);
+            entry->score = buf[i].score;
+            ++heap->size; // only marked by GC once its value is set
+        }
+        if (UNLIKELY(heap->transforms)) {
+            for (size_t i = heap->size - len; i < heap->size; ++i) {
+                SCORE *score = &DHEAP_SCORE(heap, i);
+                *score       = DHEAP_SCORE_IN_XF(heap, *score);
+            }
+        }
+        if (heap->autod) heap->autod->pushes += len;
+        if (!heap->buffering) DHEAP_FOLD(heap);
+        ALLOCV_END(bufv);
+        return self;
+    }
+    dheap_ensure_room_for_push(heap, len);
+    load.self       = self;
+    load.values     = values;
+    load.buf        = buf;
+    load.len        = len;
+    load.sign       = sign;
+    load.buffering  = heap->buffering;
+    heap->buffering = 1;
+    rb_ensure(dheap_load_pushes, (VALUE)&load, dheap_load_fold, (VALUE)&load);
+    RB_GC_GUARD(values);
+    ALLOCV_END(bufv);
+    return self;
+}
+
+/* @!visibility private */
+static VALUE
+dheap_load_buffer(VALUE self, VALUE scores, VALUE values, VALUE threads)
+{
+    return dheap_load_signed(self, scores, values, threads, 1.0);
+}
+
+static int
+dheap_entry_cmp(const void *a, const void *b)
+{
+    SCORE sa = ((const ENTRY *)a)->score;
+    SCORE sb = ((const ENTRY *)b)->score;
+    return CMP_LT(sa, sb) ? -1 : CMP_LT(sb, sa) ? 1 : 0;
+}
+
+/*
+ * Sorts the entries (a sorted array is also a valid heap) and removes the
+ * +count+ largest, for DHeap::Spill.
+ *
+ * @!visibility private
+ * @return [Array(Array<Object>, Array<Float>)] values and scores, ascending
+ */
+static VALUE
+dheap_spill_largest(VALUE self, VALUE count_val)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    size_t   count = NUM2SIZET(count_val);
+    VALUE    values, scores;
+#ifdef DHEAP_MAP
+    if (DHEAPMAP_P(heap)) rb_raise(rb_eTypeError, "can't spill a DHeap::Map");
+#endif
+    if (heap->size < count) count = heap->size;
+    qsort(heap->entries, heap->size, sizeof(ENTRY), dheap_entry_cmp);
+    heap->unsorted = 0;
+    heap->size -= count;
+    values = rb_ary_new_capa(count);
+    scores = rb_ary_new_capa(count);
+    for (size_t i = heap->size; i < heap->size + count; ++i) {
+        SCORE score = DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, i));
+        rb_ary_push(values, DHEAP_VALUE(heap, i));
+        rb_ary_push(scores, SCORE2NUM(score));
+    }
+    return rb_assoc_new(values, scores);
+}
+
+/*
+ * Clears all values from the heap, leaving it empty.
+ *
+ * @return [self]
+ */
+static VALUE
+dheap_clear(VALUE self)
+{
+    dheap_t *heap;
+    rb_check_frozen(self);
+    heap = get_dheap_struct(self);
+    if (UNLIKELY(heap->shared)) { // no need to copy entries that are discarded
+        heap->size     = 0;
+        heap->unsorted = 0;
+        dheap_release_entries(heap);
+        dheap_set_capa(heap, DHEAP_DEFAULT_CAPA);
+#ifdef DHEAP_MAP
+        if (DHEAPMAP_P(heap)) heap->indexes = rb_hash_new();
+#endif
+    }
+    heap->transforms = 0;
+    if (!DHEAP_EMPTY_P(heap)) {
+        heap->size     = 0;
+        heap->unsorted = 0;
+#ifdef DHEAP_MAP
+        if (DHEAPMAP_P(heap)) rb_hash_clear(heap->indexes);
+#endif
+    }
+    return self;
+}
+
+struct dheap_drain
+{
+    VALUE  self;
+    VALUE  values; // the drained values, by their original index
+    ENTRY *buf;    // scores, then scratch space for the sort
+    ENTRY *scores; // an untouched copy of the scores, for restoring them
+    ENTRY *sorted;
+    size_t len;
+    int    threads;
+};
+
+static VALUE
+dheap_drain_sort(VALUE ptr)
+{
+    struct dheap_drain *drain = (struct dheap_drain *)ptr;
+    drain->sorted =
+      dheap_parallel_sort(drain->buf, drain->buf + drain->len, drain->len,
+                          drain->threads);
+    return Qnil;
+}
+
+// Pushes the drained entries back when the sort was interrupted.  Entries that
+// were pushed by other threads meanwhile are kept, including DHeap::Map members
+// that were drained and then pushed again.
+static VALUE
+dheap_drain_restore(VALUE ptr)
+{
+    struct dheap_drain *drain = (struct dheap_drain *)ptr;
+    dheap_t            *heap;
+    if (drain->sorted) return Qnil;
+    heap = get_dheap_struct_unfrozen(drain->self);
+    dheap_ensure_room_for_push(heap, drain->len);
+    for (size_t i = 0; i < drain->len; ++i) {
+        ENTRY entry;
+        entry.score = drain->scores[i].score;
+        entry.value = RARRAY_AREF(drain->values, i);
+#ifdef DHEAP_MAP
+        if (DHEAPMAP_P(heap)) {
+            if (rb_hash_lookup2(heap->indexes, entry.value, Qfalse)) continue;
+            dheapmap_push_entry(drain->self, &entry);
+            continue;
+        }
+#endif
+        dheap_push_entry(drain->self, &entry);
+    }
+    return Qnil;
+}
+
+/*
+ * Removes the entries, then sorts them without the GVL, on up to threads
+ * threads.  Other threads may push (or pop) meanwhile:  they see the emptied
+ * heap, and their entries aren't drained.  If the sort is interrupted (e.g. by
+ * Thread#raise), the drained entries are pushed back.
+ *
+ * @!visibility private
+ * @return [Array<Object>] the values, in the order they would be popped
+ */
+static VALUE
+dheap_drain_sorted(VALUE self, VALUE threads_val)
+{
+    dheap_t           *heap = get_dheap_struct(self); // not unshared: cleared
+    struct dheap_drain drain;
+    VALUE              bufv = 0, result;
+    rb_check_frozen(self);
+    drain.self    = self;
+    drain.threads = dheap_value_to_threads(threads_val);
+    drain.len     = heap->size;
+    drain.sorted  = NULL;
+    drain.buf     = ALLOCV_N(ENTRY, bufv, drain.len * 3);
+    drain.scores  = drain.buf + drain.len * 2;
+    drain.values  = rb_ary_new_capa(drain.len);
+    for (size_t i = 0; i < drain.len; ++i) {
+        // the transforms are reset by clear; this conversion preserves order
+        drain.buf[i].score = DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, i));
+        drain.buf[i].value = i;
+        rb_ary_push(drain.values, DHEAP_VALUE(heap, i));
+    }
+    MEMCPY(drain.scores, drain.buf, ENTRY, drain.len);
+    dheap_clear(self);
+    rb_ensure(
+      dheap_drain_sort, (VALUE)&drain, dheap_drain_restore, (VALUE)&drain);
+    heap = get_dheap_struct(self);
+    DHEAP_STAT_ADD(heap, pops, drain.len);
+    result = rb_ary_new_capa(drain.len);
+    for (size_t i = 0; i < drain.len; ++i) {
+        rb_ary_push(result, RARRAY_AREF(drain.values, drain.sorted[i].value));
+    }
+    RB_GC_GUARD(drain.values);
+    ALLOCV_END(bufv);
+    return result;
+}
+
+/********************************************************************
+ *
+ * DHeap::Map methods
+ *
+ ********************************************************************/
+
+#ifdef DHEAP_MAP
+
+/*
+ * Retrieves the score that has been assigned to a heap member.
+ *
+ * Time complexity: <b>O(1)</b>
+ *
+ * @param object [Object] an object to lookup
+ * @return [Float,Integer,nil] the score associated with the object,
+ *                             or nil if the object isn't a member
+ */
+static VALUE
+dheapmap_aref(VALUE self, VALUE object)
+{
+    dheap_t *heap   = get_dheap_struct(self);
+    VALUE    idxval = rb_hash_lookup2(heap->indexes, object, Qfalse);
+    DHEAP_STAT_ADD(heap, hash_ops, 1);
+    if (idxval) {
+        size_t index = NUM2ULONG(idxval);
+        return SCORE2NUM(DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, index)));
+    }
+    return Qnil;
+}
+
+/*
+ * Assign a score to an object, adding it to the heap or updating as necessary.
+ *
+ * Time complexity: <b>O(log n)</b> (score decrease will be faster than
+ * score increase)
+ *
+ * @param object [Object] an object to lookup
+ * @param score [Integer,#to_f] the score to set
+ * @return [Float,Integer] the score
+ */
+static VALUE
+dheapmap_aset(VALUE self, VALUE object, VALUE score)
+{
+    dheapmap_insert(self, score, object);
+    return score;
+}
+
+// Removes a member by moving the last entry into its slot and sifting that up
+// or down.  Returns false if object isn't a member.
+static int
+dheapmap_delete_member(dheap_t *heap, VALUE object, SCORE *deleted)
+{
+    VALUE  idxval = rb_hash_lookup2(heap->indexes, object, Qfalse);
+    size_t index, last;
+    SCORE  score;
+    DHEAP_STAT_ADD(heap, hash_ops, 1);
+    if (!idxval) return 0;
+    index = NUM2ULONG(idxval);
+    if (UNLIKELY(heap->unsorted) && index < heap->size - heap->unsorted) {
+        dheap_fold(heap); // which may move the entry
+        index = NUM2ULONG(rb_hash_lookup(heap->indexes, object));
+    }
+    score = *deleted = DHEAP_SCORE(heap, index);
+    DHEAP_STAT_ADD(heap, pops, 1);
+    _DELETE_ENTRY(dheapmap, heap, index);
+    last = --heap->size;
+    if (index < last) {
+        ENTRY entry = DHEAP_GET(heap, last);
+        DHEAP_SET(dheapmap, heap, index, entry);
+        if (!heap->unsorted) {
+            if (CMP_LT(score, entry.score)) {
+                DHEAP_LAYOUT_STMT(dheapmap, heap, DHEAP_SIFT_DOWN, index);
+            } else {
+                DHEAP_LAYOUT_STMT(dheapmap, heap, DHEAP_SIFT_UP, index);
+            }
+        }
+    }
+    // otherwise, both the deleted entry and the last entry were unsorted
+    if (UNLIKELY(heap->unsorted)) --heap->unsorted;
+    DHEAP_AUTO_TICK(heap, pops);
+    return 1;
+}
+
+/*
+ * Removes an object from the heap.
+ *
+ * Time complexity: <b>O(d log n / log d)</b> <i>(worst-case)</i>
+ *
+ * @param object [Object] the member to remove
+ * @return [Float,nil] the object's score, or nil if it wasn't a member
+ *
+ * @see #delete_all
+ */
+static VALUE
+dheapmap_delete(VALUE self, VALUE object)
+{
+    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    SCORE    score;
+    if (!dheapmap_delete_member(heap, object, &score)) return Qnil;
+    return SCORE2NUM(DHEAP_SCORE_OUT(heap, score));
+}
+
+struct dheapmap_bulk_delete
+{
+    dheap_t *heap;
+    VALUE    idxvals; // Array of indexes to delete, from before any changes
+    long     deleted;
+};
+
+// Deletes each member's key from the index and marks its entry with Qundef.
+// Deleting a key can call its #hash and #eql?, so this might not finish.
+static VALUE
+dheapmap_bulk_mark(VALUE ptr)
+{
+    struct dheapmap_bulk_delete *bulk = (struct dheapmap_bulk_delete *)ptr;
+    dheap_t                     *heap = bulk->heap;
+    for (long i = 0; i < RARRAY_LEN(bulk->idxvals); ++i) {
+        size_t index = NUM2ULONG(RARRAY_AREF(bulk->idxvals, i));
+        if (heap->size <= index || DHEAP_VALUE(heap, index) == Qundef) continue;
+        _DELETE_ENTRY(dheapmap, heap, index);
+        DHEAP_VALUE(heap, index) = Qundef;
+        ++bulk->deleted;
     }
-    return array;
+    return Qnil;
+}
+
+// Always runs after marking (even when it raised), so no Qundef entries are
+// left in the heap:  compacts the unmarked entries and heapifies them.
+static VALUE
+dheapmap_bulk_compact(VALUE ptr)
+{
+    struct dheapmap_bulk_delete *bulk = (struct dheapmap_bulk_delete *)ptr;
+    dheap_t                     *heap = bulk->heap;
+    size_t                       kept = 0;
+    if (!bulk->deleted) return Qnil;
+    for (size_t i = 0; i < heap->size; ++i) {
+        if (DHEAP_VALUE(heap, i) == Qundef) continue;
+        if (kept < i) DHEAP_SET(dheapmap, heap, kept, DHEAP_GET(heap, i));
+        ++kept;
+    }
+    DHEAP_STAT_ADD(heap, pops, bulk->deleted);
+    heap->size = kept;
+    dheap_heapify(heap);
+    return Qnil;
 }
 
 /*
- * Clears all values from the heap, leaving it empty.
+ * Removes every object in +objects+ from the heap.
  *
- * @return [self]
+ * When many members are removed, the remaining entries are compacted in a
+ * single pass and then heapified, rather than sifting after each deletion.
+ *
+ * Time complexity: <b>O(n)</b>, or <b>O(k d log n / log d)</b> when the k
+ * objects are only a small fraction of the heap.
+ *
+ * @param objects [Array, #to_a] the members to remove
+ * @return [Integer] the number of members that were removed
+ *
+ * @see #delete
+ * @see #delete_if
  */
 static VALUE
-dheap_clear(VALUE self)
+dheapmap_delete_all(VALUE self, VALUE objects)
 {
-    dheap_t *heap = get_dheap_struct_unfrozen(self);
-    if (!DHEAP_EMPTY_P(heap)) {
-        heap->size = 0;
-#ifdef DHEAP_MAP
-        if (DHEAPMAP_P(heap)) rb_hash_clear(heap->indexes);
-#endif
+    dheap_t                    *heap = get_dheap_struct_unfrozen(self);
+    struct dheapmap_bulk_delete bulk = { heap, Qnil, 0 };
+    long                        len;
+    objects = rb_convert_type(objects, T_ARRAY, "Array", "to_a");
+    len     = RARRAY_LEN(objects);
+    // Like dheap_fold:  compare the worst-case sifts with a heapify.
+    if ((size_t)len < heap->size / dheap_levels(heap)) {
+        for (long i = 0; i < len; ++i) {
+            SCORE score;
+            VALUE object = RARRAY_AREF(objects, i);
+            bulk.deleted += dheapmap_delete_member(heap, object, &score);
+        }
+        return LONG2NUM(bulk.deleted);
+    }
+    // Any lookup might raise, so they're all done before the heap is changed.
+    bulk.idxvals = rb_ary_new();
+    for (long i = 0; i < len; ++i) {
+        VALUE idxval =
+          rb_hash_lookup2(heap->indexes, RARRAY_AREF(objects, i), Qfalse);
+        DHEAP_STAT_ADD(heap, hash_ops, 1);
+        if (idxval) rb_ary_push(bulk.idxvals, idxval);
+    }
+    rb_ensure(dheapmap_bulk_mark,
+              (VALUE)&bulk,
+              dheapmap_bulk_compact,
+              (VALUE)&bulk);
+    RB_GC_GUARD(bulk.idxvals);
+    return LONG2NUM(bulk.deleted);
+}
+
+static VALUE
+dheapmap_enum_size(VALUE self, VALUE args, VALUE eobj)
+{
+    return dheap_size(self);
+}
+
+// Yields each member and its score, from a copy, so the block may modify the
+// heap.  Then deletes every member for which the block's result != keep.
+static long
+dheapmap_filter(VALUE self, int keep)
+{
+    VALUE values, scores, doomed = rb_ary_new();
+    get_dheap_struct_unfrozen(self);
+    values = dheap_values(self);
+    scores = dheap_scores_buffer(self);
+    for (long i = 0; i < RARRAY_LEN(values); ++i) {
+        VALUE value = RARRAY_AREF(values, i);
+        SCORE score;
+        memcpy(&score, RSTRING_PTR(scores) + i * sizeof(SCORE), sizeof(SCORE));
+        if (RTEST(rb_yield_values(2, value, SCORE2NUM(score))) != keep) {
+            rb_ary_push(doomed, value);
+        }
     }
+    return NUM2LONG(dheapmap_delete_all(self, doomed));
+}
+
+/*
+ * Deletes every member for which the block returns a truthy value.  Members
+ * are yielded in heap order, not sorted order.
+ *
+ * Time complexity: <b>O(n)</b>, see #delete_all
+ *
+ * @yieldparam value [Object] each member
+ * @yieldparam score [Float] the member's score
+ *
+ * @return [self]
+ * @return [Enumerator] if no block is given
+ *
+ * @see #reject!
+ * @see #keep_if
+ */
+static VALUE
+dheapmap_delete_if(VALUE self)
+{
+    RETURN_SIZED_ENUMERATOR(self, 0, 0, dheapmap_enum_size);
+    dheapmap_filter(self, 0);
+    return self;
+}
+
+/*
+ * Like #delete_if, but returns nil if no members were deleted.
+ *
+ * @yieldparam (see #delete_if)
+ * @return [self, nil]
+ * @return [Enumerator] if no block is given
+ */
+static VALUE
+dheapmap_reject_bang(VALUE self)
+{
+    RETURN_SIZED_ENUMERATOR(self, 0, 0, dheapmap_enum_size);
+    return dheapmap_filter(self, 0) ? self : Qnil;
+}
+
+/*
+ * Deletes every member for which the block returns a falsey value.  Members
+ * are yielded in heap order, not sorted order.
+ *
+ * Time complexity: <b>O(n)</b>, see #delete_all
+ *
+ * @yieldparam (see #delete_if)
+ * @return [self]
+ * @return [Enumerator] if no block is given
+ *
+ * @see #select!
+ * @see #delete_if
+ */
+static VALUE
+dheapmap_keep_if(VALUE self)
+{
+    RETURN_SIZED_ENUMERATOR(self, 0, 0, dheapmap_enum_size);
+    dheapmap_filter(self, 1);
     return self;
 }
 
+/*
+ * Like #keep_if, but returns nil if no members were deleted.
+ *
+ * @yieldparam (see #delete_if)
+ * @return [self, nil]
+ * @return [Enumerator] if no block is given
+ */
+static VALUE
+dheapmap_select_bang(VALUE self)
+{
+    RETURN_SIZED_ENUMERATOR(self, 0, 0, dheapmap_enum_size);
+    return dheapmap_filter(self, 1) ? self : Qnil;
+}
+
+#endif
+
 /********************************************************************
  *
- * DHeap::Map methods
+ * DHeap::Max methods
+ *
+ * Scores are stored negated, so a max-heap runs the same min-heap sift code,
+ * with no extra comparisons or branches for either DHeap or DHeap::Max.
+ * Scores are only negated where they cross the ruby API, by these overrides.
  *
  ********************************************************************/
 
-#ifdef DHEAP_MAP
+#define DHEAPMAX_SCORE_NUM(heap, idx)                                          \
+    SCORE2NUM(-DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, idx)))
+
+/* (see DHeap#insert) */
+static VALUE
+dheapmax_insert(VALUE self, VALUE score, VALUE value)
+{
+    ENTRY entry = { -VAL2SCORE(score), value };
+    dheap_push_entry(self, &entry);
+    return self;
+}
+
+/* (see DHeap#push) */
+static VALUE
+dheapmax_push(int argc, VALUE *argv, VALUE self)
+{
+    ENTRY entry = dheap_push_args_to_entry(argc, argv);
+    entry.score = -entry.score;
+    dheap_push_entry(self, &entry);
+    return self;
+}
+
+/* (see DHeap#<<) */
+static VALUE
+dheapmax_lshift(VALUE self, VALUE value)
+{
+    ENTRY entry = { -VAL2SCORE(value), value };
+    dheap_push_entry(self, &entry);
+    return self;
+}
+
+/* (see DHeap#peek_score) */
+static VALUE
+dheapmax_peek_score(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    DHEAP_FOLD(heap);
+    if (DHEAP_EMPTY_P(heap)) return Qnil;
+    return DHEAPMAX_SCORE_NUM(heap, 0);
+}
+
+/* (see DHeap#peek_with_score) */
+static VALUE
+dheapmax_peek_with_score(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    DHEAP_FOLD(heap);
+    if (DHEAP_EMPTY_P(heap)) return Qnil;
+    return rb_assoc_new(PEEK_VALUE(heap), DHEAPMAX_SCORE_NUM(heap, 0));
+}
+
+/* (see DHeap#pop_with_score) */
+static VALUE
+dheapmax_pop_with_score(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    VALUE    popped;
+    DHEAP_FOLD(heap);
+    if (DHEAP_EMPTY_P(heap)) return Qnil;
+    popped = rb_assoc_new(PEEK_VALUE(heap), DHEAPMAX_SCORE_NUM(heap, 0));
+    if (DHEAP_PAGED_P(heap)) {
+        DHEAP_DELETE_0(dheap_paged, heap);
+    } else {
+        DHEAP_DELETE_0(dheap, heap);
+    }
+    return popped;
+}
 
 /*
- * Retrieves the score that has been assigned to a heap member.
+ * Pops the maximum value only if it is greater than or equal to a min score.
  *
- * Time complexity: <b>O(1)</b>
+ * Time complexity: <b>O(d log n / log d)</b> <i>(worst-case)</i>
  *
- * @param object [Object] an object to lookup
- * @return [Float,Integer,nil] the score associated with the object,
- *                             or nil if the object isn't a member
+ * @param min_score [Integer,#to_f] the minimum score to be popped
+ *
+ * @return [Object] the value with the maximum score
+ *
+ * @see #pop_gt
+ * @see #pop_all_above
  */
 static VALUE
-dheapmap_aref(VALUE self, VALUE object)
+dheapmax_pop_gte(VALUE self, VALUE min_score)
 {
-    dheap_t *heap   = get_dheap_struct(self);
-    VALUE    idxval = rb_hash_lookup2(heap->indexes, object, Qfalse);
-    if (idxval) {
-        size_t index = NUM2ULONG(idxval);
-        return SCORE2NUM(DHEAP_SCORE(heap, index));
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = -VAL2SCORE(min_score);
+    VALUE    popped;
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_LTE, score, &popped);
+    return popped;
+}
+
+/*
+ * Pops the maximum value only if it is greater than a min score.
+ *
+ * Time complexity: <b>O(d log n / log d)</b> <i>(worst-case)</i>
+ *
+ * @param min_score [Integer,#to_f] the minimum score to be popped
+ *
+ * @return [Object] the value with the maximum score
+ *
+ * @see #pop_gte
+ * @see #pop_all_above
+ */
+static VALUE
+dheapmax_pop_gt(VALUE self, VALUE min_score)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    SCORE    score = -VAL2SCORE(min_score);
+    VALUE    popped;
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_LT, score, &popped);
+    return popped;
+}
+
+/*
+ * @overload pop_all_above(min_score, receiver = [])
+ *
+ * Pops all values with a score greater than min score.
+ *
+ * Time complexity: <b>O(m * d log n / log d)</b>, <i>m = number popped</i>
+ *
+ * @param min_score [Integer,#to_f] the minimum score to be popped
+ * @param receiver  [Array,#<<] object onto which the values will be pushed,
+ *                              in order by score (descending).
+ *
+ * @return [Object] the object onto which the values were pushed
+ *
+ * @see #pop_gt
+ */
+static VALUE
+dheapmax_pop_all_above(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap      = get_dheap_struct_unfrozen(self);
+    SCORE    max_score = argc ? -VAL2SCORE(argv[0]) : 0;
+    VALUE    array     = (argc == 1) ? rb_ary_new() : argv[1];
+    rb_check_arity(argc, 1, 2);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, POP_ALL_BELOW, max_score, array);
+    return array;
+}
+
+/* (see DHeap#push_pop) */
+static VALUE
+dheapmax_push_pop(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    entry.score = DHEAP_SCORE_IN(heap, -entry.score);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, PUSH_POP, entry, &popped);
+    return popped;
+}
+
+/* (see DHeap#replace_top) */
+static VALUE
+dheapmax_replace_top(int argc, VALUE *argv, VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct_unfrozen(self);
+    ENTRY    entry = dheap_push_args_to_entry(argc, argv);
+    VALUE    popped;
+    entry.score = DHEAP_SCORE_IN(heap, -entry.score);
+    DHEAP_FOLD(heap);
+    DHEAP_LAYOUT_STMT(dheap, heap, REPLACE_TOP, entry, &popped);
+    return popped;
+}
+
+/* (see DHeap#shift_scores!) */
+static VALUE
+dheapmax_shift_scores(VALUE self, VALUE delta)
+{
+    return dheap_transform_scores(self, 1.0, -dheap_value_to_delta(delta));
+}
+
+/* (see DHeap#to_a) */
+static VALUE
+dheapmax_to_a(VALUE self)
+{
+    dheap_t *heap  = get_dheap_struct(self);
+    VALUE    array = rb_ary_new_capa(heap->size);
+    DHEAP_FOLD(heap);
+    for (size_t i = 0; i < heap->size; i++) {
+        rb_ary_push(array,
+                    rb_assoc_new(DHEAP_VALUE(heap, i),
+                                 DHEAPMAX_SCORE_NUM(heap, i)));
     }
-    return Qnil;
+    return array;
+}
+
+/* (see DHeap#scores_buffer) */
+static VALUE
+dheapmax_scores_buffer(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    VALUE    str;
+    char    *ptr;
+    DHEAP_FOLD(heap);
+    str = rb_str_new(NULL, heap->size * sizeof(SCORE));
+    ptr = RSTRING_PTR(str);
+    for (size_t i = 0; i < heap->size; ++i) {
+        SCORE score = -DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, i));
+        memcpy(ptr + i * sizeof(SCORE), &score, sizeof(SCORE));
+    }
+    return str;
+}
+
+/* @!visibility private */
+static VALUE
+dheapmax_load_buffer(VALUE self, VALUE scores, VALUE values, VALUE threads)
+{
+    return dheap_load_signed(self, scores, values, threads, -1.0);
+}
+
+/********************************************************************
+ *
+ * DHeap stats
+ *
+ ********************************************************************/
+
+#ifdef DHEAP_STATS
+
+/* @!visibility private */
+static VALUE
+dheap_init_stats(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct_unfrozen(self);
+    if (!heap->stats) heap->stats = ZALLOC(dheap_stats_t);
+    return self;
+}
+
+#    define STATS_HASH_SET(hash, name, num)                                    \
+        rb_hash_aset(hash, ID2SYM(rb_intern(name)), ULL2NUM(num))
+
+static VALUE
+dheap_stats_depths_ary(const unsigned long long *depths)
+{
+    long  len = DHEAP_STATS_DEPTHS;
+    VALUE ary;
+    while (0 < len && !depths[len - 1])
+        --len;
+    ary = rb_ary_new_capa(len);
+    for (long i = 0; i < len; ++i) {
+        rb_ary_push(ary, ULL2NUM(depths[i]));
+    }
+    return ary;
 }
 
 /*
- * Assign a score to an object, adding it to the heap or updating as necessary.
+ * Returns the operation counters that have been collected for this heap.
  *
- * Time complexity: <b>O(log n)</b> (score decrease will be faster than
- * score increase)
+ * Only available when the extension was compiled with +--enable-stats+, and
+ * only collected for heaps that were created with <tt>stats: true</tt>.
  *
- * @param object [Object] an object to lookup
- * @param score [Integer,#to_f] the score to set
- * @return [Float,Integer] the score
+ * The depth histograms are indexed by the number of levels that an entry
+ * moved during a single sift, e.g. <tt>sift_down_depths[3]</tt> counts the
+ * sift-downs that moved an entry three levels down the tree.  Every unbuffered
+ * push adds one sift-up and every pop adds one sift-down, at depth zero when
+ * nothing moved, so the sums can be compared with +pushes+ and +pops+.
+ * Rescores, deletes, and heapify add more; fused push-pops add at most one.
+ *
+ * @return [Hash{Symbol => Integer, Array<Integer>}, nil] pushes, pops,
+ *     rescores, comparisons, moves, sift_up_depths, sift_down_depths,
+ *     capacity_growths, realloc_bytes, hash_ops; or nil when stats aren't
+ *     enabled for this heap.
+ *
+ * @see #reset_stats
  */
 static VALUE
-dheapmap_aset(VALUE self, VALUE object, VALUE score)
+dheap_stats(VALUE self)
 {
-    dheapmap_insert(self, score, object);
-    return score;
+    dheap_t       *heap  = get_dheap_struct(self);
+    dheap_stats_t *stats = heap->stats;
+    VALUE          hash;
+    if (!stats) return Qnil;
+    hash = rb_hash_new();
+    STATS_HASH_SET(hash, "pushes", stats->pushes);
+    STATS_HASH_SET(hash, "pops", stats->pops);
+    STATS_HASH_SET(hash, "rescores", stats->rescores);
+    STATS_HASH_SET(hash, "comparisons", stats->comparisons);
+    STATS_HASH_SET(hash, "moves", stats->moves);
+    rb_hash_aset(hash,
+                 ID2SYM(rb_intern("sift_up_depths")),
+                 dheap_stats_depths_ary(stats->sift_up_depths));
+    rb_hash_aset(hash,
+                 ID2SYM(rb_intern("sift_down_depths")),
+                 dheap_stats_depths_ary(stats->sift_down_depths));
+    STATS_HASH_SET(hash, "capacity_growths", stats->capa_growths);
+    STATS_HASH_SET(hash, "realloc_bytes", stats->realloc_bytes);
+    STATS_HASH_SET(hash, "hash_ops", stats->hash_ops);
+    return hash;
+}
+
+/*
+ * Zeroes all of the counters returned by {#stats}.
+ *
+ * @return [self]
+ */
+static VALUE
+dheap_reset_stats(VALUE self)
+{
+    dheap_t *heap = get_dheap_struct(self);
+    if (heap->stats) MEMZERO(heap->stats, dheap_stats_t, 1);
+    return self;
 }
 
 #endif
@@ -1035,15 +2563,22 @@ dheapmap_aset(VALUE self, VALUE object, VALUE score)
 void
 Init_d_heap(void)
 {
-    VALUE rb_cDHeap = rb_define_class("DHeap", rb_cObject);
+    VALUE rb_cDHeap    = rb_define_class("DHeap", rb_cObject);
+    VALUE rb_cDHeapMax = rb_define_class_under(rb_cDHeap, "Max", rb_cDHeap);
 #ifdef DHEAP_MAP
     VALUE rb_cDHeapMap = rb_define_class_under(rb_cDHeap, "Map", rb_cDHeap);
 #endif
 
-    id_cmp    = rb_intern_const("<=>");
-    id_abs    = rb_intern_const("abs");
-    id_lshift = rb_intern_const("<<");
-    id_uminus = rb_intern_const("-@");
+    id_cmp       = rb_intern_const("<=>");
+    id_abs       = rb_intern_const("abs");
+    id_lshift    = rb_intern_const("<<");
+    id_uminus    = rb_intern_const("-@");
+    id_auto      = rb_intern_const("auto");
+    id_flat      = rb_intern_const("flat");
+    id_paged     = rb_intern_const("paged");
+    id_clock     = rb_intern_const("clock");
+    id_monotonic = rb_intern_const("monotonic");
+    id_realtime  = rb_intern_const("realtime");
 
     rb_define_alloc_func(rb_cDHeap, dheap_s_alloc);
 
@@ -1080,15 +2615,35 @@ Init_d_heap(void)
     rb_define_method(rb_cDHeap, "initialize_copy", dheap_initialize_copy, 1);
 
     rb_define_method(rb_cDHeap, "d", dheap_attr_d, 0);
+    rb_define_method(rb_cDHeap, "buffered?", dheap_buffered_p, 0);
+    rb_define_method(rb_cDHeap, "buffered=", dheap_set_buffered, 1);
+    rb_define_method(rb_cDHeap, "layout", dheap_attr_layout, 0);
+    rb_define_private_method(
+      rb_cDHeap, "__init_layout__", dheap_init_layout, 1);
     rb_define_method(rb_cDHeap, "size", dheap_size, 0);
     rb_define_method(rb_cDHeap, "empty?", dheap_empty_p, 0);
     rb_define_method(rb_cDHeap, "to_a", dheap_to_a, 0);
+    rb_define_method(rb_cDHeap, "scores_buffer", dheap_scores_buffer, 0);
+    rb_define_method(rb_cDHeap, "values", dheap_values, 0);
+    rb_define_private_method(
+      rb_cDHeap, "__load_buffer__", dheap_load_buffer, 3);
+    rb_define_private_method(
+      rb_cDHeap, "__drain_sorted__", dheap_drain_sorted, 1);
 
     rb_define_method(rb_cDHeap, "clear", dheap_clear, 0);
     rb_define_method(rb_cDHeap, "peek", dheap_peek, 0);
     rb_define_method(rb_cDHeap, "peek_score", dheap_peek_score, 0);
     rb_define_method(rb_cDHeap, "peek_with_score", dheap_peek_with_score, 0);
     rb_define_method(rb_cDHeap, "pop_all_below", dheap_pop_all_below, -1);
+    rb_define_method(rb_cDHeap, "pop_due", dheap_pop_due, -1);
+    rb_define_method(rb_cDHeap, "next_timeout", dheap_next_timeout, -1);
+    rb_define_method(rb_cDHeap, "shift_scores!", dheap_shift_scores, 1);
+    rb_define_method(rb_cDHeap, "scale_scores!", dheap_scale_scores, 1);
+    rb_define_private_method(
+      rb_cDHeap, "__stored_score__", dheap_stored_score, 1);
+    rb_define_private_method(rb_cDHeap, "__clock_now__", dheap_clock_now, 1);
+    rb_define_private_method(
+      rb_cDHeap, "__spill_largest__", dheap_spill_largest, 1);
 
     def_override_inherited("insert", insert, 2);
     def_override_inherited("push", push, -1);
@@ -1098,9 +2653,50 @@ Init_d_heap(void)
     def_override_inherited("pop_lt", pop_lt, 1);
     def_override_inherited("pop_lte", pop_lte, 1);
     def_override_inherited("pop_with_score", pop_with_score, 0);
+    def_override_inherited("push_pop", push_pop, -1);
+    def_override_inherited("replace_top", replace_top, -1);
+
+#ifdef DHEAP_STATS
+    rb_define_private_method(rb_cDHeap, "__init_stats__", dheap_init_stats, 0);
+    rb_define_method(rb_cDHeap, "stats", dheap_stats, 0);
+    rb_define_method(rb_cDHeap, "reset_stats", dheap_reset_stats, 0);
+#else
+    rb_define_private_method(rb_cDHeap, "__init_stats__", rb_f_notimplement, -1);
+    rb_define_method(rb_cDHeap, "stats", rb_f_notimplement, -1);
+    rb_define_method(rb_cDHeap, "reset_stats", rb_f_notimplement, -1);
+#endif
 
 #ifdef DHEAP_MAP
     rb_define_method(rb_cDHeapMap, "[]", dheapmap_aref, 1);
     rb_define_method(rb_cDHeapMap, "[]=", dheapmap_aset, 2);
+    rb_define_method(rb_cDHeapMap, "delete", dheapmap_delete, 1);
+    rb_define_method(rb_cDHeapMap, "delete_all", dheapmap_delete_all, 1);
+    rb_define_method(rb_cDHeapMap, "delete_if", dheapmap_delete_if, 0);
+    rb_define_method(rb_cDHeapMap, "reject!", dheapmap_reject_bang, 0);
+    rb_define_method(rb_cDHeapMap, "keep_if", dheapmap_keep_if, 0);
+    rb_define_method(rb_cDHeapMap, "select!", dheapmap_select_bang, 0);
 #endif
+
+    rb_define_method(rb_cDHeapMax, "insert", dheapmax_insert, 2);
+    rb_define_method(rb_cDHeapMax, "push", dheapmax_push, -1);
+    rb_define_method(rb_cDHeapMax, "<<", dheapmax_lshift, 1);
+    rb_define_method(rb_cDHeapMax, "peek_score", dheapmax_peek_score, 0);
+    rb_define_method(
+      rb_cDHeapMax, "peek_with_score", dheapmax_peek_with_score, 0);
+    rb_define_method(
+      rb_cDHeapMax, "pop_with_score", dheapmax_pop_with_score, 0);
+    rb_define_method(rb_cDHeapMax, "pop_gt", dheapmax_pop_gt, 1);
+    rb_define_method(rb_cDHeapMax, "pop_gte", dheapmax_pop_gte, 1);
+    rb_define_method(rb_cDHeapMax, "pop_all_above", dheapmax_pop_all_above, -1);
+    rb_define_method(rb_cDHeapMax, "push_pop", dheapmax_push_pop, -1);
+    rb_define_method(rb_cDHeapMax, "replace_top", dheapmax_replace_top, -1);
+    rb_define_method(rb_cDHeapMax, "to_a", dheapmax_to_a, 0);
+    rb_define_method(rb_cDHeapMax, "shift_scores!", dheapmax_shift_scores, 1);
+    rb_define_method(rb_cDHeapMax, "scores_buffer", dheapmax_scores_buffer, 0);
+    rb_define_private_method(
+      rb_cDHeapMax, "__load_buffer__", dheapmax_load_buffer, 3);
+
+    Init_d_heap_dijkstra(rb_cDHeap);
+    Init_d_heap_merge(rb_cDHeap);
+    Init_d_heap_topk(rb_cDHeap);
 }
@@ -0,0 +1,541 @@
+#ifndef D_HEAP_H
+#define D_HEAP_H 1
+
+/*
+ * The heap's types, index math, and sift macros.  These don't depend on
+ * anything from ruby other than VALUE and a few macros, so they are also
+ * compiled (without linking libruby) into the native benchmarks, in
+ * benchmarks/native/.
+ */
+
+#include "ruby.h"
+
+/********************************************************************
+ *
+ * Type definitions
+ *
+ ********************************************************************/
+
+typedef struct dheap_struct dheap_t;
+typedef struct dheap_entry  ENTRY;
+typedef struct dheap_auto   dheap_auto_t;
+#ifdef DHEAP_STATS
+typedef struct dheap_stats dheap_stats_t;
+#endif
+
+typedef double SCORE;
+
+/********************************************************************
+ *
+ * Struct definitions
+ *
+ ********************************************************************/
+
+struct dheap_struct
+{
+    int           d;
+    int           buffering; // when true, pushes are appended to unsorted
+    size_t        size;
+    size_t        capa;
+    size_t        unsorted;    // the last entries haven't been sifted up yet
+    size_t        page_nodes;  // nodes per page, or 0 for the flat layout
+    size_t        page_leaves; // nodes on each page's bottom level
+    ENTRY        *entries;
+    size_t       *shared; // copy-on-write refcount, NULL unless shared by dup
+    size_t        transforms; // pending lazy shift_scores! and scale_scores!
+    SCORE         scale;      // when transforms:  stored * scale + offset
+    SCORE         offset;
+    dheap_auto_t *autod;  // NULL unless d: :auto
+#ifdef DHEAP_MAP
+    VALUE indexes; // Hash
+#endif
+#ifdef DHEAP_STATS
+    dheap_stats_t *stats; // NULL unless enabled for this heap
+#endif
+};
+
+struct dheap_entry
+{
+    SCORE score;
+    VALUE value;
+};
+
+// Counts the operation mix over a window, for d: :auto
+struct dheap_auto
+{
+    size_t             window; // number of operations to sample
+    size_t             ops;
+    size_t             pushes;
+    size_t             pops;
+    size_t             rescores;
+    unsigned long long size_sum; // divide by ops for the mean size
+};
+
+#ifdef DHEAP_STATS
+// A sift can't move more levels than there are bits in size_t (at d=2).
+#    define DHEAP_STATS_DEPTHS (SIZEOF_SIZE_T * 8 + 1)
+
+struct dheap_stats
+{
+    unsigned long long pushes;
+    unsigned long long pops;
+    unsigned long long rescores;
+    unsigned long long comparisons;
+    unsigned long long moves;
+    unsigned long long capa_growths;
+    unsigned long long realloc_bytes;
+    unsigned long long hash_ops;
+    unsigned long long sift_up_depths[DHEAP_STATS_DEPTHS];
+    unsigned long long sift_down_depths[DHEAP_STATS_DEPTHS];
+};
+#endif
+
+#define DHEAPMAP_P(heap) UNLIKELY(RTEST((heap)->indexes))
+
+/********************************************************************
+ *
+ * Constant definitions
+ *
+ ********************************************************************/
+
+#define DHEAP_DEFAULT_D 6
+#define DHEAP_MAX_D     INT_MAX
+
+// d: :auto chooses from 2..DHEAP_AUTO_MAX_D, sampling at least
+// DHEAP_AUTO_MIN_WINDOW operations (or the heap size, if larger) before it
+// will consider rebuilding, and only rebuilding when that would reduce the
+// predicted comparisons by DHEAP_AUTO_MIN_GAIN.
+#define DHEAP_AUTO_MAX_D      32
+#define DHEAP_AUTO_MIN_WINDOW 1024
+#define DHEAP_AUTO_MIN_GAIN   0.1
+
+// layout: :paged packs page_nodes (at most this many bytes of entries) into
+// each page
+#define DHEAP_PAGE_SIZE 4096
+
+// sizeof(ENTRY) => 16 bytes, 128-bits
+// one kilobyte = 32 * 32 bytes
+#define DHEAP_DEFAULT_CAPA  32
+#define DHEAP_MAX_CAPA      (SIZE_MAX / (int)sizeof(ENTRY))
+#define DHEAP_CAPA_INCR_MAX (10 * 1024 * 1024 / (int)sizeof(ENTRY))
+
+// lazy score transforms are materialized after this many, or when the scale is
+// outside of 2**-32..2**32, so the stored scores don't drift too far.
+#define DHEAP_MAX_TRANSFORMS 64
+#define DHEAP_MIN_SCALE      0x1p-32
+#define DHEAP_MAX_SCALE      0x1p32
+
+// threads: for DHeap.from_buffer and DHeap#drain_sorted is capped at this
+#define DHEAP_MAX_THREADS 256
+
+// Smaller loads are appended and folded with the GVL:  releasing it (and
+// copying the entries back) costs more than the heapify itself.
+#define DHEAP_NOGVL_MIN_LOAD 4096
+
+/********************************************************************
+ *
+ * Metaprogramming macros
+ *
+ ********************************************************************/
+
+#define LIKELY   RB_LIKELY
+#define UNLIKELY RB_UNLIKELY
+
+// Compiled away entirely unless built with `--enable-stats`.  When compiled,
+// each costs one (well predicted) branch for heaps without stats enabled.
+#ifdef DHEAP_STATS
+#    define DHEAP_STAT_ADD(heap, field, n)                                     \
+        do {                                                                   \
+            if (UNLIKELY((heap)->stats)) (heap)->stats->field += (n);          \
+        } while (0)
+#    define DHEAP_STAT_DEPTH_VAR(var) size_t var = 0
+#    define DHEAP_STAT_DEPTH_INCR(var) (++(var))
+#    define DHEAP_STAT_DEPTH(heap, field, depth)                               \
+        DHEAP_STAT_ADD(heap, field[depth], 1)
+#else
+#    define DHEAP_STAT_ADD(heap, field, n)
+#    define DHEAP_STAT_DEPTH_VAR(var)
+#    define DHEAP_STAT_DEPTH_INCR(var)
+#    define DHEAP_STAT_DEPTH(heap, field, depth)
+#endif
+
+#ifdef DHEAP_MAP
+#    define DHEAP_DISPATCH_EXPR(func, heap, ...)                               \
+        (DHEAPMAP_P(heap) ? dheapmap_##func(heap, __VA_ARGS__)                 \
+                          : dheap_##func(heap, __VA_ARGS__))
+#else
+#    define DHEAP_DISPATCH_EXPR(func, heap, ...)                               \
+        dheap_##func(heap, __VA_ARGS__);
+#endif
+
+// Dispatches on both the heap type and its layout (see DHEAP_LAYOUT_STMT).
+#ifdef DHEAP_MAP
+#    define DHEAP_DISPATCH_STMT(heap, macro, ...)                              \
+        do {                                                                   \
+            if (DHEAPMAP_P(heap)) {                                            \
+                DHEAP_LAYOUT_STMT(dheapmap, heap, macro, __VA_ARGS__);         \
+            } else {                                                           \
+                DHEAP_LAYOUT_STMT(dheap, heap, macro, __VA_ARGS__);            \
+            }                                                                  \
+        } while (0)
+#else
+#    define DHEAP_DISPATCH_STMT(heap, macro, ...)                              \
+        DHEAP_LAYOUT_STMT(dheap, heap, macro, __VA_ARGS__)
+#endif
+
+/********************************************************************
+ *
+ * SCORE: casting to and from VALUE
+ *    adapted from similar methods in ruby's object.c
+ *
+ ********************************************************************/
+
+#define SCORE2NUM(score) rb_float_new(score)
+#define VAL2SCORE(val)   NUM2DBL(RB_FLOAT_TYPE_P(val) ? val : rb_Float(val))
+#define CMP_LT(a, b)     ((a) < (b))
+#define CMP_LTE(a, b)    ((a) <= (b))
+
+/********************************************************************
+ *
+ * DHeap ENTRY accessors
+ *
+ ********************************************************************/
+
+#define DHEAP_SCORE(heap, idx) (DHEAP_GET(heap, idx).score)
+#define DHEAP_VALUE(heap, idx) (DHEAP_GET(heap, idx).value)
+
+// Converts scores between ruby and the stored frame, which doesn't include any
+// pending lazy transforms (for scale > 0, both preserve the order of scores).
+#define DHEAP_SCORE_IN(heap, score)                                            \
+    (UNLIKELY((heap)->transforms) ? DHEAP_SCORE_IN_XF(heap, score) : (score))
+#define DHEAP_SCORE_OUT(heap, score)                                           \
+    (UNLIKELY((heap)->transforms) ? DHEAP_SCORE_OUT_XF(heap, score) : (score))
+
+// Loops over many scores check heap->transforms once, up front, and then use
+// one of these frames for every score.
+#define DHEAP_SCORE_RAW(heap, score) (score)
+#define DHEAP_SCORE_IN_XF(heap, score)                                         \
+    (((score) - (heap)->offset) / (heap)->scale)
+#define DHEAP_SCORE_OUT_XF(heap, score)                                        \
+    ((score) * (heap)->scale + (heap)->offset)
+
+#define DHEAP_ENTRY_ARY(heap, idx)                                             \
+    (((heap)->size <= (idx))                                                   \
+       ? Qnil                                                                  \
+       : rb_ary_new_from_args(                                                 \
+           2,                                                                  \
+           DHEAP_VALUE(heap, idx),                                             \
+           SCORE2NUM(DHEAP_SCORE_OUT(heap, DHEAP_SCORE(heap, idx)))))
+
+#define DHEAP_GET(heap, idx) ((heap)->entries[idx])
+#define DHEAP_SET(T, heap, index, entry)                                       \
+    do {                                                                       \
+        DHEAP_GET(heap, index) = (entry);                                      \
+        DHEAP_STAT_ADD(heap, moves, 1);                                        \
+        DHEAP_SET_##T(heap, index, entry);                                     \
+    } while (0)
+
+#define DHEAP_SET_dheap(heap, index, entry) /* noop */
+#define DHEAP_SET_dheap_paged DHEAP_SET_dheap
+
+#ifdef DHEAP_MAP
+#    define DHEAP_SET_dheapmap(heap, index, entry)                             \
+        do {                                                                   \
+            DHEAP_STAT_ADD(heap, hash_ops, 1);                                 \
+            rb_hash_aset((heap)->indexes, (entry).value, ULONG2NUM(index));    \
+        } while (0)
+#    define DHEAP_SET_dheapmap_paged DHEAP_SET_dheapmap
+#endif
+
+/********************************************************************
+ *
+ * DHeap index math
+ *
+ ********************************************************************/
+
+#define DHEAP_IDX_LAST(heap) ((heap)->size - 1)
+
+#define DHEAP_FLAT_PARENT(heap, idx)  (((idx)-1) / (heap)->d)
+#define DHEAP_FLAT_CHILD_0(heap, idx) (((idx) * (heap)->d) + 1)
+#define DHEAP_FLAT_CHILD_D(heap, idx) (((idx) * (heap)->d) + (heap)->d)
+
+/*
+ * layout: :paged (a B-heap)
+ *
+ * The root is alone at index 0, and every other node is in a "page" of
+ * page_nodes entries, starting at index 1.  Each page holds a forest of d
+ * sibling subtrees, several levels deep, in level order:  so a node's d
+ * children are always consecutive, and are on the same page unless the node is
+ * on its page's bottom level.  The children of the k-th bottom-level node (counting
+ * every page's bottom level, in order) are the roots of page k + 1.  Page 0
+ * holds the root's children.
+ *
+ * Every child's index is greater than its parent's, so the heap still fills a
+ * prefix of the entries array, and the last entry is always a leaf.  But,
+ * unlike the flat layout, the entries that have children aren't a prefix.
+ *
+ * A sift-down moves through several levels per page, rather than touching a
+ * new page at every level once the heap is much larger than a page.
+ */
+
+#define DHEAP_PAGED_P(heap) UNLIKELY((heap)->page_nodes)
+
+// Every heap type T also defines DHEAP_PAGED_##T, its layout, as a constant.
+// So each sift is compiled for a single layout, and the flat layout's sifts
+// never check for pages.  The "_paged" types are their flat types' twins, for
+// the paged layout.  Methods choose between them once, with DHEAP_LAYOUT_STMT.
+#define DHEAP_PAGED_dheap          0
+#define DHEAP_PAGED_dheap_paged    1
+#define DHEAP_PAGED_dheapmap       0
+#define DHEAP_PAGED_dheapmap_paged 1
+
+#define DHEAP_LAYOUT_STMT(T, heap, macro, ...)                                 \
+    do {                                                                       \
+        if (DHEAP_PAGED_P(heap)) {                                             \
+            macro(T##_paged, heap, __VA_ARGS__);                               \
+        } else {                                                               \
+            macro(T, heap, __VA_ARGS__);                                       \
+        }                                                                      \
+    } while (0)
+
+// Fits as many levels of d-ary subtrees into each page as possible (at least
+// one level, when even d entries don't fit).  Must be called whenever d
+// changes.
+static inline void
+dheap_set_pages(dheap_t *heap)
+{
+    size_t d = heap->d, leaves = d, nodes = d;
+    while ((nodes + leaves * d) * sizeof(ENTRY) <= DHEAP_PAGE_SIZE) {
+        leaves *= d;
+        nodes += leaves;
+    }
+    heap->page_nodes  = nodes;
+    heap->page_leaves = leaves;
+}
+
+// A node's page and its offset within that page.  Not for the root.
+static inline void
+dheap_paged_pos(const dheap_t *heap, size_t idx, size_t *page, size_t *local)
+{
+    *page  = (idx - 1) / heap->page_nodes;
+    *local = (idx - 1) - *page * heap->page_nodes;
+}
+
+// Moves page and local from a node to its parent, and returns the parent's
+// index.  Only divides by page_leaves when crossing into the parent page.
+static inline size_t
+dheap_paged_up(const dheap_t *heap, size_t *page, size_t *local)
+{
+    size_t nodes = heap->page_nodes, leaves = heap->page_leaves;
+    if ((size_t)heap->d <= *local) {
+        *local = *local / heap->d - 1;
+    } else if (*page) {
+        // a page's roots are children of a bottom-level node on an earlier page
+        *local = (nodes - leaves) + (*page - 1) % leaves;
+        *page  = (*page - 1) / leaves;
+    } else {
+        return 0;
+    }
+    return 1 + *page * nodes + *local;
+}
+
+// Moves page and local from a node (or from the root, when idx is 0) to its
+// first child, and returns the first child's index.  Never divides.
+static inline size_t
+dheap_paged_down(const dheap_t *heap, size_t idx, size_t *page, size_t *local)
+{
+    size_t inner = heap->page_nodes - heap->page_leaves;
+    if (!idx) {
+        *page = *local = 0;
+    } else if (*local < inner) {
+        *local = heap->d * (*local + 1);
+    } else {
+        *page  = *page * heap->page_leaves + (*local - inner) + 1;
+        *local = 0;
+    }
+    return 1 + *page * heap->page_nodes + *local;
+}
+
+static inline size_t
+dheap_paged_parent(const dheap_t *heap, size_t idx)
+{
+    size_t page, local;
+    dheap_paged_pos(heap, idx, &page, &local);
+    return dheap_paged_up(heap, &page, &local);
+}
+
+static inline size_t
+dheap_paged_child_0(const dheap_t *heap, size_t idx)
+{
+    size_t page = 0, local = 0;
+    if (idx) dheap_paged_pos(heap, idx, &page, &local);
+    return dheap_paged_down(heap, idx, &page, &local);
+}
+
+#define DHEAP_IDX_PARENT(heap, idx)                                            \
+    (DHEAP_PAGED_P(heap) ? dheap_paged_parent(heap, idx)                       \
+                         : DHEAP_FLAT_PARENT(heap, idx))
+#define DHEAP_IDX_CHILD_0(heap, idx)                                           \
+    (DHEAP_PAGED_P(heap) ? dheap_paged_child_0(heap, idx)                      \
+                         : DHEAP_FLAT_CHILD_0(heap, idx))
+
+#ifdef DEBUG
+#    define ASSERT_DHEAP_IDX_OK(heap, index)                                   \
+        do {                                                                   \
+            if (DHEAP_IDX_LAST(heap) < index) {                                \
+                rb_raise(rb_eIndexError, "DHeap index %ld too large", index);  \
+            }                                                                  \
+        } while (0)
+#else
+#    define ASSERT_DHEAP_IDX_OK(heap, index)
+#endif
+
+/********************************************************************
+ *
+ * DHeap sift up/down
+ *
+ ********************************************************************/
+
+#define DHEAP_SIFT_UP(T, heap, i)                                              \
+    do {                                                                       \
+        size_t sift_idx = i;                                                   \
+        ENTRY  entry    = DHEAP_GET(heap, sift_idx);                           \
+        DHEAP_STAT_DEPTH_VAR(sift_depth);                                      \
+        ASSERT_DHEAP_IDX_OK(heap, sift_idx);                                   \
+        if (DHEAP_PAGED_##T) {                                                 \
+            size_t page, local;                                                \
+            dheap_paged_pos(heap, sift_idx, &page, &local);                    \
+            for (size_t parent_idx; 0 < sift_idx; sift_idx = parent_idx) {     \
+                parent_idx = dheap_paged_up(heap, &page, &local);              \
+                DHEAP_STAT_ADD(heap, comparisons, 1);                          \
+                if (CMP_LTE(DHEAP_SCORE(heap, parent_idx), entry.score)) {     \
+                    break;                                                     \
+                }                                                              \
+                DHEAP_SET(T, heap, sift_idx, DHEAP_GET(heap, parent_idx));     \
+                DHEAP_STAT_DEPTH_INCR(sift_depth);                             \
+            }                                                                  \
+        } else {                                                               \
+            for (size_t parent_idx; 0 < sift_idx; sift_idx = parent_idx) {     \
+                parent_idx = DHEAP_FLAT_PARENT(heap, sift_idx);                \
+                DHEAP_STAT_ADD(heap, comparisons, 1);                          \
+                if (CMP_LTE(DHEAP_SCORE(heap, parent_idx), entry.score)) {     \
+                    break;                                                     \
+                }                                                              \
+                DHEAP_SET(T, heap, sift_idx, DHEAP_GET(heap, parent_idx));     \
+                DHEAP_STAT_DEPTH_INCR(sift_depth);                             \
+            }                                                                  \
+        }                                                                      \
+        DHEAP_SET(T, heap, sift_idx, entry);                                   \
+        DHEAP_STAT_DEPTH(heap, sift_up_depths, sift_depth);                    \
+    } while (0)
+
+// Returns the index of the minimum sibling from min_child to last_sib.
+static inline size_t
+dheap_min_sibling(dheap_t *heap, size_t min_child, size_t last_sib)
+{
+    DHEAP_STAT_ADD(heap, comparisons, last_sib - min_child);
+
+    for (size_t sibidx = min_child + 1; sibidx <= last_sib; ++sibidx) {
+        if (CMP_LT(DHEAP_SCORE(heap, sibidx), DHEAP_SCORE(heap, min_child))) {
+            min_child = sibidx;
+        }
+    }
+    return min_child;
+}
+
+static inline size_t
+dheap_min_child(dheap_t *heap, size_t parent, size_t last_index)
+{
+    size_t last_sib = DHEAP_FLAT_CHILD_D(heap, parent);
+    if (UNLIKELY(last_index < last_sib)) last_sib = last_index;
+    return dheap_min_sibling(heap, DHEAP_FLAT_CHILD_0(heap, parent), last_sib);
+}
+
+#define DHEAP_CAN_SIFT_DOWN(heap, index, last_index)                           \
+    (LIKELY(1 <= last_index && index <= DHEAP_FLAT_PARENT(heap, last_index)))
+
+#define DHEAP_SIFT_DOWN(T, heap, i)                                            \
+    do {                                                                       \
+        size_t sift_idx = i;                                                   \
+        size_t last_idx = DHEAP_IDX_LAST(heap);                                \
+        ASSERT_DHEAP_IDX_OK(heap, sift_idx);                                   \
+        if (DHEAP_PAGED_##T) {                                                 \
+            DHEAP_SIFT_DOWN_PAGED(T, heap, sift_idx, last_idx);                \
+        } else if (DHEAP_CAN_SIFT_DOWN(heap, sift_idx, last_idx)) {            \
+            ENTRY  entry       = heap->entries[sift_idx];                      \
+            size_t last_parent = DHEAP_FLAT_PARENT(heap, last_idx);            \
+            DHEAP_STAT_DEPTH_VAR(sift_depth);                                  \
+            while (sift_idx <= last_parent) {                                  \
+                size_t min_child = dheap_min_child(heap, sift_idx, last_idx);  \
+                DHEAP_STAT_ADD(heap, comparisons, 1);                          \
+                if (CMP_LTE(entry.score, DHEAP_SCORE(heap, min_child))) break; \
+                DHEAP_SET(T, heap, sift_idx, (heap)->entries[min_child]);      \
+                sift_idx = min_child;                                          \
+                DHEAP_STAT_DEPTH_INCR(sift_depth);                             \
+            }                                                                  \
+            DHEAP_SET(T, heap, sift_idx, entry);                               \
+            DHEAP_STAT_DEPTH(heap, sift_down_depths, sift_depth);              \
+        } else {                                                               \
+            DHEAP_STAT_DEPTH(heap, sift_down_depths, 0);                       \
+        }                                                                      \
+    } while (0)
+
+// Nodes with children aren't a prefix of the paged layout, so each step checks
+// for a first child instead of comparing against the last parent.
+#define DHEAP_SIFT_DOWN_PAGED(T, heap, sift_idx, last_idx)                     \
+    do {                                                                       \
+        size_t page = 0, local = 0, child_idx;                                 \
+        if (sift_idx) dheap_paged_pos(heap, sift_idx, &page, &local);          \
+        child_idx = dheap_paged_down(heap, sift_idx, &page, &local);           \
+        if (child_idx < (heap)->size) {                                        \
+            ENTRY entry = heap->entries[sift_idx];                             \
+            DHEAP_STAT_DEPTH_VAR(sift_depth);                                  \
+            do {                                                               \
+                size_t last_sib  = child_idx + (heap)->d - 1;                  \
+                size_t min_child = dheap_min_sibling(                          \
+                  heap, child_idx, last_idx < last_sib ? last_idx : last_sib); \
+                DHEAP_STAT_ADD(heap, comparisons, 1);                          \
+                if (CMP_LTE(entry.score, DHEAP_SCORE(heap, min_child))) break; \
+                DHEAP_SET(T, heap, sift_idx, (heap)->entries[min_child]);      \
+                local += min_child - child_idx;                                \
+                sift_idx  = min_child;                                         \
+                child_idx = dheap_paged_down(heap, sift_idx, &page, &local);   \
+                DHEAP_STAT_DEPTH_INCR(sift_depth);                             \
+            } while (child_idx < (heap)->size);                                \
+            DHEAP_SET(T, heap, sift_idx, entry);                               \
+            DHEAP_STAT_DEPTH(heap, sift_down_depths, sift_depth);              \
+        } else {                                                               \
+            DHEAP_STAT_DEPTH(heap, sift_down_depths, 0);                       \
+        }                                                                      \
+    } while (0)
+
+// Floyd's bottom-up heapify: O(n), in place.  Every parent precedes its
+// children in both layouts, but the paged layout's parents aren't a prefix.
+#define DHEAP_HEAPIFY(T, heap)                                                 \
+    do {                                                                       \
+        if (1 < (heap)->size) {                                                \
+            size_t heapify_idx =                                               \
+              DHEAP_PAGED_##T                                                  \
+                ? (heap)->size                                                 \
+                : DHEAP_FLAT_PARENT(heap, DHEAP_IDX_LAST(heap)) + 1;           \
+            while (0 < heapify_idx--) {                                        \
+                DHEAP_SIFT_DOWN(T, heap, heapify_idx);                         \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+/********************************************************************
+ *
+ * Other translation units
+ *
+ ********************************************************************/
+
+void Init_d_heap_dijkstra(VALUE rb_cDHeap); // dijkstra.c
+void Init_d_heap_merge(VALUE rb_cDHeap);    // merge.c
+void Init_d_heap_topk(VALUE rb_cDHeap);     // topk.c
+
+// parallel.c:  for entries whose values are indexes, without the GVL
+void   dheap_parallel_heapify(dheap_t *heap, int threads);
+ENTRY *dheap_parallel_sort(ENTRY *entries, ENTRY *tmp, size_t len, int threads);
+
+#endif /* D_HEAP_H */
@@ -0,0 +1,341 @@
+#include "ruby.h"
+#include "ruby/thread.h"
+#include <math.h>
+#include <stdint.h>
+
+#include "d_heap.h"
+
+/********************************************************************
+ *
+ * Dijkstra's shortest paths, over a CSR (compressed sparse row) graph
+ *
+ * Node u's edges are offsets[u] ... offsets[u+1] - 1, indexes into the targets
+ * and weights arrays.  The search runs without the GVL, on a d-ary heap of node
+ * indexes scored by their tentative distance.  The heap uses the same sift
+ * macros as DHeap, with a "dijkstra" variant of DHEAP_SET that tracks each
+ * node's heap index, for decrease-key.
+ *
+ ********************************************************************/
+
+#define DIJKSTRA_UNSEEN SIZE_MAX
+#define DIJKSTRA_DONE   (SIZE_MAX - 1)
+#define DIJKSTRA_NONE   SIZE_MAX
+
+// DHEAP_SET_dijkstra needs the position array, so it casts heap back to this
+typedef struct dijkstra_heap
+{
+    dheap_t heap; // must be first
+    size_t *pos;  // node => heap index, DIJKSTRA_UNSEEN, or DIJKSTRA_DONE
+} dijkstra_heap_t;
+
+#define DHEAP_SET_dijkstra(heap, index, entry)                                 \
+    (((dijkstra_heap_t *)(heap))->pos[(entry).value] = (index))
+#define DHEAP_PAGED_dijkstra 0
+
+typedef struct dijkstra
+{
+    size_t        n; // number of nodes
+    const size_t *offsets;
+    const size_t *targets;
+    const double *weights;
+    size_t        source;
+    size_t        target; // DIJKSTRA_NONE to search the entire graph
+
+    double         *dist;
+    size_t         *pred; // DIJKSTRA_NONE for the source and unreached nodes
+    dijkstra_heap_t dh;
+
+    // owned copies of Array (or unaligned String) inputs
+    size_t *offsets_buf;
+    size_t *targets_buf;
+    double *weights_buf;
+    // packed String inputs, which are locked while the search uses them
+    VALUE locked[3];
+    int   nlocked;
+
+    volatile int interrupted;
+    int          done;
+} dijkstra_t;
+
+/********************************************************************
+ *
+ * Input conversion and validation (with the GVL)
+ *
+ ********************************************************************/
+
+// Uses a packed String's buffer directly (when it's aligned), otherwise copies
+// the String or Array into *buf.
+static const void *
+dijkstra_input(dijkstra_t *dj,
+               VALUE       obj,
+               const char *name,
+               size_t      elem_size,
+               int         is_double,
+               size_t     *len,
+               void      **buf)
+{
+    if (RB_TYPE_P(obj, T_STRING)) {
+        const char *ptr   = RSTRING_PTR(obj);
+        size_t      bytes = RSTRING_LEN(obj);
+        if (bytes % elem_size) {
+            rb_raise(rb_eArgError,
+                     "%s: packed String length %zu isn't a multiple of %zu",
+                     name,
+                     bytes,
+                     elem_size);
+        }
+        *len = bytes / elem_size;
+        if ((uintptr_t)ptr % elem_size) {
+            *buf = ruby_xmalloc2(*len ? *len : 1, elem_size);
+            memcpy(*buf, ptr, bytes);
+            return *buf;
+        }
+        for (int i = 0; i < dj->nlocked; ++i) {
+            if (dj->locked[i] == obj) return ptr; // e.g. offsets == targets
+        }
+        rb_str_locktmp(obj);
+        dj->locked[dj->nlocked++] = obj;
+        return ptr;
+    }
+    Check_Type(obj, T_ARRAY);
+    *len = RARRAY_LEN(obj);
+    *buf = ruby_xmalloc2(*len ? *len : 1, elem_size);
+    for (size_t i = 0; i < *len; ++i) {
+        VALUE num = RARRAY_AREF(obj, i);
+        if (is_double) {
+            ((double *)*buf)[i] = VAL2SCORE(num);
+        } else {
+            ((size_t *)*buf)[i] = NUM2SIZET(num);
+        }
+    }
+    return *buf;
+}
+
+static void
+dijkstra_validate(dijkstra_t *dj, size_t targets_len, size_t weights_len)
+{
+    size_t edges = dj->offsets[dj->n];
+    if (targets_len < edges || weights_len < edges) {
+        rb_raise(rb_eArgError,
+                 "offsets has %zu edges, targets has %zu, weights has %zu",
+                 edges,
+                 targets_len,
+                 weights_len);
+    }
+    for (size_t u = 0; u < dj->n; ++u) {
+        if (dj->offsets[u + 1] < dj->offsets[u]) {
+            rb_raise(
+              rb_eArgError, "offsets must be non-decreasing (at %zu)", u);
+        }
+    }
+    for (size_t e = dj->offsets[0]; e < edges; ++e) {
+        if (dj->n <= dj->targets[e]) {
+            rb_raise(rb_eIndexError,
+                     "targets[%zu] = %zu is not a node",
+                     e,
+                     dj->targets[e]);
+        }
+        if (!(0.0 <= dj->weights[e])) { // also catches NaN
+            rb_raise(rb_eArgError,
+                     "weights[%zu] = %g must not be negative",
+                     e,
+                     dj->weights[e]);
+        }
+    }
+    if (dj->n <= dj->source) {
+        rb_raise(rb_eIndexError, "source %zu is not a node", dj->source);
+    }
+    if (dj->target != DIJKSTRA_NONE && dj->n <= dj->target) {
+        rb_raise(rb_eIndexError, "target %zu is not a node", dj->target);
+    }
+}
+
+/********************************************************************
+ *
+ * The search (without the GVL)
+ *
+ ********************************************************************/
+
+static void
+dijkstra_init_search(dijkstra_t *dj)
+{
+    dheap_t *heap = &dj->dh.heap;
+    size_t  *pos  = dj->dh.pos;
+    ENTRY    src  = { 0.0, (VALUE)dj->source };
+    for (size_t i = 0; i < dj->n; ++i) {
+        dj->dist[i] = HUGE_VAL;
+        dj->pred[i] = DIJKSTRA_NONE;
+        pos[i]      = DIJKSTRA_UNSEEN;
+    }
+    dj->dist[dj->source] = 0.0;
+    DHEAP_SET(dijkstra, heap, 0, src);
+    heap->size = 1;
+}
+
+static void *
+dijkstra_search(void *ptr)
+{
+    dijkstra_t   *dj      = ptr;
+    dheap_t      *heap    = &dj->dh.heap;
+    size_t       *pos     = dj->dh.pos;
+    double       *dist    = dj->dist;
+    size_t       *pred    = dj->pred;
+    const size_t *offsets = dj->offsets;
+    const size_t *targets = dj->targets;
+    const double *weights = dj->weights;
+
+    while (LIKELY(heap->size)) {
+        ENTRY  min = DHEAP_GET(heap, 0);
+        size_t u   = min.value;
+        if (UNLIKELY(dj->interrupted)) return NULL;
+        pos[u] = DIJKSTRA_DONE;
+        if (0 < --heap->size) {
+            DHEAP_SET(dijkstra, heap, 0, heap->entries[heap->size]);
+            DHEAP_SIFT_DOWN(dijkstra, heap, 0);
+        }
+        if (UNLIKELY(u == dj->target)) break;
+        for (size_t e = offsets[u]; e < offsets[u + 1]; ++e) {
+            size_t v   = targets[e];
+            double alt = min.score + weights[e];
+            if (pos[v] == DIJKSTRA_DONE || !CMP_LT(alt, dist[v])) continue;
+            dist[v] = alt;
+            pred[v] = u;
+            if (pos[v] == DIJKSTRA_UNSEEN) {
+                ENTRY entry = { alt, (VALUE)v };
+                DHEAP_SET(dijkstra, heap, heap->size, entry);
+                ++heap->size;
+                DHEAP_SIFT_UP(dijkstra, heap, DHEAP_IDX_LAST(heap));
+            } else {
+                DHEAP_SCORE(heap, pos[v]) = alt;
+                DHEAP_SIFT_UP(dijkstra, heap, pos[v]);
+            }
+        }
+    }
+    dj->done = 1;
+    return NULL;
+}
+
+static void
+dijkstra_ubf(void *ptr)
+{
+    dijkstra_t *dj  = ptr;
+    dj->interrupted = 1;
+}
+
+/********************************************************************
+ *
+ * DHeap.dijkstra
+ *
+ ********************************************************************/
+
+struct dijkstra_args
+{
+    dijkstra_t *dj;
+    VALUE       offsets, targets, weights, source, target, d;
+};
+
+static VALUE
+dijkstra_body(VALUE ptr)
+{
+    struct dijkstra_args *args = (struct dijkstra_args *)ptr;
+    dijkstra_t           *dj   = args->dj;
+    size_t                offsets_len, targets_len, weights_len;
+    int                   d = NUM2INT(args->d);
+    VALUE                 dist, pred, inf;
+
+    if (d < 2) rb_raise(rb_eArgError, "DHeap d=%d is too small", d);
+    dj->source = NUM2SIZET(args->source);
+    dj->target = NIL_P(args->target) ? DIJKSTRA_NONE : NUM2SIZET(args->target);
+    dj->offsets = dijkstra_input(dj,
+                                 args->offsets,
+                                 "offsets",
+                                 sizeof(size_t),
+                                 0,
+                                 &offsets_len,
+                                 (void **)&dj->offsets_buf);
+    dj->targets = dijkstra_input(dj,
+                                 args->targets,
+                                 "targets",
+                                 sizeof(size_t),
+                                 0,
+                                 &targets_len,
+                                 (void **)&dj->targets_buf);
+    dj->weights = dijkstra_input(dj,
+                                 args->weights,
+                                 "weights",
+                                 sizeof(double),
+                                 1,
+                                 &weights_len,
+                                 (void **)&dj->weights_buf);
+    if (offsets_len < 1) rb_raise(rb_eArgError, "offsets must not be empty");
+    dj->n = offsets_len - 1;
+    dijkstra_validate(dj, targets_len, weights_len);
+
+    dj->dist            = ALLOC_N(double, dj->n);
+    dj->pred            = ALLOC_N(size_t, dj->n);
+    dj->dh.pos          = ALLOC_N(size_t, dj->n);
+    dj->dh.heap.entries = ALLOC_N(ENTRY, dj->n);
+    dj->dh.heap.capa    = dj->n;
+    dj->dh.heap.d       = d;
+
+    dijkstra_init_search(dj);
+    while (!dj->done) {
+        dj->interrupted = 0;
+        rb_thread_call_without_gvl(dijkstra_search, dj, dijkstra_ubf, dj);
+        rb_thread_check_ints();
+    }
+
+    dist = rb_ary_new_capa(dj->n);
+    pred = rb_ary_new_capa(dj->n);
+    inf  = DBL2NUM(HUGE_VAL); // not a flonum, so share one for unreached nodes
+    for (size_t i = 0; i < dj->n; ++i) {
+        rb_ary_push(dist,
+                    dj->dist[i] == HUGE_VAL ? inf : DBL2NUM(dj->dist[i]));
+        rb_ary_push(pred,
+                    dj->pred[i] == DIJKSTRA_NONE ? Qnil
+                                                 : SIZET2NUM(dj->pred[i]));
+    }
+    return rb_assoc_new(dist, pred);
+}
+
+static VALUE
+dijkstra_ensure(VALUE ptr)
+{
+    dijkstra_t *dj = (dijkstra_t *)ptr;
+    for (int i = 0; i < dj->nlocked; ++i)
+        rb_str_unlocktmp(dj->locked[i]);
+    xfree(dj->offsets_buf);
+    xfree(dj->targets_buf);
+    xfree(dj->weights_buf);
+    xfree(dj->dist);
+    xfree(dj->pred);
+    xfree(dj->dh.pos);
+    xfree(dj->dh.heap.entries);
+    return Qnil;
+}
+
+/* @!visibility private */
+static VALUE
+dheap_s_dijkstra(VALUE klass,
+                 VALUE offsets,
+                 VALUE targets,
+                 VALUE weights,
+                 VALUE source,
+                 VALUE target,
+                 VALUE d)
+{
+    dijkstra_t           dj;
+    struct dijkstra_args args = {
+        &dj, offsets, targets, weights, source, target, d,
+    };
+    MEMZERO(&dj, dijkstra_t, 1);
+    return rb_ensure(
+      dijkstra_body, (VALUE)&args, dijkstra_ensure, (VALUE)&dj);
+}
+
+void
+Init_d_heap_dijkstra(VALUE rb_cDHeap)
+{
+    rb_define_private_method(
+      rb_singleton_class(rb_cDHeap), "__dijkstra__", dheap_s_dijkstra, 6);
+}
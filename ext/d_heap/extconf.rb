@@ -38,7 +38,14 @@ if enable_config("heapmap", true)
   $defs.push "-DDHEAP_MAP"
 end
 
+# Use `rake compile -- --enable-stats` (always enabled for debug builds)
+if enable_config("stats", ENV["EXTCONF_STATS"] == "1" || debug_mode)
+  $stderr.puts "Building with DHeap#stats support." # rubocop:disable Style/StderrPuts
+  $defs.push "-DDHEAP_STATS"
+end
+
 have_func "rb_gc_mark_movable" # since ruby-2.7
+have_func "pthread_create", "pthread.h" # for threads: > 1
 
 check_sizeof("long")
 check_sizeof("unsigned long long")
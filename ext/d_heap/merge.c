@@ -0,0 +1,179 @@
+#include "ruby.h"
+
+#include "d_heap.h"
+
+/********************************************************************
+ *
+ * k-way merge of sorted sources, with a loser tree
+ *
+ * The tree has k leaves (one per source) and k - 1 internal nodes, laid out
+ * like a binary heap:  leaf i is node k + i, and node n's parent is n / 2.  Each
+ * internal node holds the source that lost the match played there, and node 0
+ * holds the overall winner.  After the winner's source advances, only the
+ * matches on its path to the root are replayed:  ceil(log2 k) comparisons per
+ * element, against the losers already stored there.
+ *
+ * Arrays are read by index, and their elements are compared by score in C, so
+ * (without +by+) there is no ruby method dispatch per element.  Other sources
+ * are read with Enumerator#next.
+ *
+ ********************************************************************/
+
+static ID id_next;
+static ID id_call;
+
+typedef struct merge
+{
+    long    k;
+    VALUE   sources;
+    VALUE   by;    // nil, or scores each element with #call
+    VALUE   heads; // each source's current element, for GC
+    long   *pos;   // next index into each Array source, -1 for enumerators
+    SCORE  *scores;
+    char   *done;  // exhausted sources
+    long   *tree;  // losers at 1 ... k-1, the winner at 0
+} merge_t;
+
+// the source of a beats the source of b (ties go to the earlier source)
+#define MERGE_BEATS(m, a, b)                                                   \
+    (!(m)->done[a] &&                                                          \
+     ((m)->done[b] || CMP_LT((m)->scores[a], (m)->scores[b]) ||                \
+      (!CMP_LT((m)->scores[b], (m)->scores[a]) && (a) < (b))))
+
+static VALUE
+merge_next(VALUE source)
+{
+    return rb_funcallv(source, id_next, 0, NULL);
+}
+
+static VALUE
+merge_stop(VALUE done, VALUE err)
+{
+    *(int *)done = 1;
+    return Qnil;
+}
+
+// Reads the source's next element and score, or marks it done.
+static void
+merge_advance(merge_t *m, long i)
+{
+    VALUE source = RARRAY_AREF(m->sources, i);
+    VALUE elem;
+    if (0 <= m->pos[i]) {
+        if (RARRAY_LEN(source) <= m->pos[i]) {
+            m->done[i] = 1;
+            rb_ary_store(m->heads, i, Qnil);
+            return;
+        }
+        elem = RARRAY_AREF(source, m->pos[i]++);
+    } else {
+        int stopped = 0;
+        elem        = rb_rescue2(merge_next,
+                          source,
+                          merge_stop,
+                          (VALUE)&stopped,
+                          rb_eStopIteration,
+                          (VALUE)0);
+        if (stopped) {
+            m->done[i] = 1;
+            rb_ary_store(m->heads, i, Qnil);
+            return;
+        }
+    }
+    rb_ary_store(m->heads, i, elem);
+    m->scores[i] =
+      VAL2SCORE(NIL_P(m->by) ? elem : rb_funcallv(m->by, id_call, 1, &elem));
+}
+
+// Plays every match below node, and returns the winner.
+static long
+merge_build(merge_t *m, long node)
+{
+    long left, right;
+    if (m->k <= node) return node - m->k;
+    left  = merge_build(m, node * 2);
+    right = merge_build(m, node * 2 + 1);
+    if (MERGE_BEATS(m, left, right)) {
+        m->tree[node] = right;
+        return left;
+    }
+    m->tree[node] = left;
+    return right;
+}
+
+// Replays the matches from the winner's leaf to the root.
+static void
+merge_replay(merge_t *m, long winner)
+{
+    for (long node = (winner + m->k) / 2; 0 < node; node /= 2) {
+        long loser = m->tree[node];
+        if (MERGE_BEATS(m, loser, winner)) {
+            m->tree[node] = winner;
+            winner        = loser;
+        }
+    }
+    m->tree[0] = winner;
+}
+
+/* @!visibility private */
+static VALUE
+dheap_s_merge_sorted(VALUE klass, VALUE sources, VALUE by, VALUE batch_size)
+{
+    merge_t m;
+    VALUE   bufv = 0, result, batch;
+    long    batch_max = NUM2LONG(batch_size);
+    int     yielding  = rb_block_given_p();
+    char   *buf;
+
+    Check_Type(sources, T_ARRAY);
+    if (batch_max < 1) rb_raise(rb_eArgError, "batch_size must be positive");
+    m.sources = sources = rb_ary_dup(sources);
+    m.k       = RARRAY_LEN(sources);
+    m.by      = by;
+    m.heads   = rb_ary_new_capa(m.k);
+    // one buffer, freed by GC if an exception is raised
+    buf = ALLOCV(bufv,
+                 (sizeof(long) * 2 + sizeof(SCORE) + 1) * (m.k ? m.k : 1));
+    m.pos    = (long *)buf;
+    m.tree   = m.pos + m.k;
+    m.scores = (SCORE *)(m.tree + m.k);
+    m.done   = (char *)(m.scores + m.k);
+
+    for (long i = 0; i < m.k; ++i) {
+        m.pos[i]  = RB_TYPE_P(RARRAY_AREF(sources, i), T_ARRAY) ? 0 : -1;
+        m.done[i] = 0;
+        merge_advance(&m, i);
+    }
+    if (m.k) m.tree[0] = merge_build(&m, 1);
+
+    result = yielding ? Qnil : rb_ary_new();
+    batch  = yielding ? rb_ary_new_capa(batch_max) : result;
+    while (m.k && !m.done[m.tree[0]]) {
+        long winner = m.tree[0];
+        rb_ary_push(batch, RARRAY_AREF(m.heads, winner));
+        merge_advance(&m, winner);
+        merge_replay(&m, winner);
+        if (yielding && batch_max <= RARRAY_LEN(batch)) {
+            rb_yield(batch);
+            batch = rb_ary_new_capa(batch_max);
+        }
+    }
+    if (yielding && RARRAY_LEN(batch)) rb_yield(batch);
+
+    ALLOCV_END(bufv);
+    RB_GC_GUARD(m.sources);
+    RB_GC_GUARD(m.heads);
+    return result;
+}
+
+void
+Init_d_heap_merge(VALUE rb_cDHeap)
+{
+    id_next = rb_intern_const("next");
+    id_call = rb_intern_const("call");
+
+    rb_define_private_method(rb_singleton_class(rb_cDHeap),
+                             "__merge_sorted__",
+                             dheap_s_merge_sorted,
+                             3);
+}
@@ -0,0 +1,315 @@
+#include "ruby.h"
+#include "ruby/thread.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_CREATE
+#    include <pthread.h>
+#endif
+
+#include "d_heap.h"
+
+/********************************************************************
+ *
+ * Parallel heapify and sort, without the GVL
+ *
+ * These run on scratch entries whose values are indexes, not VALUEs, so
+ * nothing here is visible to (or can be moved by) the GC, and other ruby
+ * threads can run, even ones that modify the heap the entries came from.
+ *
+ * A bottom-up heapify only sifts each node down into its own subtree, so the
+ * nodes on any one level of the tree can be sifted concurrently:  each level is
+ * split between the threads, and the threads are joined between levels.  Sorts
+ * use parallel qsorts of (at least) one run per thread, followed by rounds of
+ * parallel pairwise merges.
+ *
+ * When interrupted, the current level (or sort phase) is abandoned, and it is
+ * restarted from scratch after any pending interrupts have been handled.
+ * Redoing a heapify level or a merge round is harmless:  its inputs are
+ * unchanged.
+ *
+ ********************************************************************/
+
+#define DHEAP_SET_parallel(heap, index, entry) /* noop */
+#define DHEAP_SET_parallel_paged               DHEAP_SET_parallel
+#define DHEAP_PAGED_parallel                   0
+#define DHEAP_PAGED_parallel_paged             1
+
+// Don't split work into pieces smaller than this.
+#define PARALLEL_MIN_CHUNK 4096
+
+// How many sifts or merged entries between checks for interrupts.
+#define PARALLEL_CHECK_INTERVAL 8192
+
+// Sorts are split into runs of at most this many entries, so interrupts are
+// checked between qsorts.
+#define PARALLEL_MAX_RUN (64 * 1024)
+
+typedef struct parallel parallel_t;
+
+typedef struct parallel_task
+{
+    parallel_t *par;
+    size_t      start, end; // a range of nodes, or of runs
+} parallel_task_t;
+
+struct parallel
+{
+    int          threads;
+    volatile int interrupted;
+    int          done;
+
+    // heapify
+    dheap_t *heap;
+    size_t   level_start, level_end; // the level that is being heapified
+
+    // sort
+    ENTRY  *src, *dst;
+    size_t *bounds; // runs are src[bounds[i] ... bounds[i + 1] - 1]
+    size_t  runs;
+    int     sorted_runs;
+};
+
+// Runs fn over [0, len) split into chunks, on up to par->threads threads (the
+// calling thread included).  Falls back to fewer threads if they can't be
+// created.
+static void
+parallel_each(parallel_t *par,
+              size_t      len,
+              size_t      min_chunk,
+              void *(*fn)(void *))
+{
+    parallel_task_t tasks[DHEAP_MAX_THREADS];
+    size_t          n = par->threads;
+#ifdef HAVE_PTHREAD_CREATE
+    pthread_t tids[DHEAP_MAX_THREADS];
+    size_t    started = 0;
+#endif
+    if (len / min_chunk < n) n = len / min_chunk;
+    if (n < 1) n = 1;
+    for (size_t i = 0; i < n; ++i) {
+        tasks[i].par   = par;
+        tasks[i].start = len * i / n;
+        tasks[i].end   = len * (i + 1) / n;
+    }
+#ifdef HAVE_PTHREAD_CREATE
+    for (size_t i = 1; i < n; ++i, ++started) {
+        if (pthread_create(&tids[i], NULL, fn, &tasks[i])) break;
+    }
+    fn(&tasks[0]);
+    for (size_t i = 1; i <= started; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    for (size_t i = started + 1; i < n; ++i) {
+        fn(&tasks[i]);
+    }
+#else
+    for (size_t i = 0; i < n; ++i) {
+        fn(&tasks[i]);
+    }
+#endif
+}
+
+static void
+parallel_ubf(void *ptr)
+{
+    parallel_t *par  = ptr;
+    par->interrupted = 1;
+}
+
+// Releases the GVL until fn sets par->done, handling interrupts in between.
+static void
+parallel_run(parallel_t *par, void *(*fn)(void *))
+{
+    while (!par->done) {
+        par->interrupted = 0;
+        rb_thread_call_without_gvl(fn, par, parallel_ubf, par);
+        rb_thread_check_ints();
+    }
+}
+
+/********************************************************************
+ *
+ * Heapify
+ *
+ ********************************************************************/
+
+static void *
+parallel_sift_downs(void *ptr)
+{
+    parallel_task_t *task = ptr;
+    parallel_t      *par  = task->par;
+    dheap_t         *heap = par->heap;
+    size_t           idx  = par->level_start + task->end;
+    while (par->level_start + task->start < idx) {
+        --idx;
+        DHEAP_SIFT_DOWN(parallel, heap, idx);
+        if (idx % PARALLEL_CHECK_INTERVAL == 0 && par->interrupted) break;
+    }
+    return NULL;
+}
+
+static void *
+parallel_heapify_nogvl(void *ptr)
+{
+    parallel_t *par  = ptr;
+    dheap_t    *heap = par->heap;
+    size_t      d    = heap->d;
+    // the paged layout isn't split into levels, so it uses just one thread
+    if (DHEAP_PAGED_P(heap)) {
+        DHEAP_HEAPIFY(parallel_paged, heap);
+        par->done = 1;
+        return NULL;
+    }
+    while (!par->interrupted) {
+        parallel_each(par,
+                      par->level_end - par->level_start,
+                      PARALLEL_MIN_CHUNK,
+                      parallel_sift_downs);
+        if (par->interrupted) break;
+        if (!par->level_start) {
+            par->done = 1;
+            break;
+        }
+        // the next level up
+        par->level_end   = par->level_start;
+        par->level_start = (par->level_start - 1) / d;
+    }
+    return NULL;
+}
+
+// Heapifies entries whose values are indexes, on up to threads threads.
+void
+dheap_parallel_heapify(dheap_t *heap, int threads)
+{
+    parallel_t par;
+    size_t     d = heap->d, start = 0, last_parent;
+    if (heap->size < 2) return;
+    MEMZERO(&par, parallel_t, 1);
+    par.threads = threads;
+    par.heap    = heap;
+    // find the deepest level with children:  levels start at 0, 1, d+1, ...
+    last_parent = DHEAP_FLAT_PARENT(heap, DHEAP_IDX_LAST(heap));
+    while (start * d + 1 <= last_parent) {
+        start = start * d + 1;
+    }
+    par.level_start = start;
+    par.level_end   = last_parent + 1;
+    parallel_run(&par, parallel_heapify_nogvl);
+}
+
+/********************************************************************
+ *
+ * Sort
+ *
+ ********************************************************************/
+
+// Sorts by score, then by index, so the sort is stable.
+static int
+parallel_entry_cmp(const void *a, const void *b)
+{
+    const ENTRY *ea = a, *eb = b;
+    if (CMP_LT(ea->score, eb->score)) return -1;
+    if (CMP_LT(eb->score, ea->score)) return 1;
+    return (ea->value > eb->value) - (ea->value < eb->value);
+}
+
+static void *
+parallel_sort_runs(void *ptr)
+{
+    parallel_task_t *task = ptr;
+    parallel_t      *par  = task->par;
+    for (size_t r = task->start; r < task->end; ++r) {
+        size_t start = par->bounds[r];
+        qsort(par->src + start,
+              par->bounds[r + 1] - start,
+              sizeof(ENTRY),
+              parallel_entry_cmp);
+        if (par->interrupted) break;
+    }
+    return NULL;
+}
+
+static void *
+parallel_merge_pairs(void *ptr)
+{
+    parallel_task_t *task = ptr;
+    parallel_t      *par  = task->par;
+    for (size_t r = task->start * 2; r < task->end * 2; r += 2) {
+        size_t a = par->bounds[r], a_end = par->bounds[r + 1];
+        size_t b = a_end, b_end = a_end; // an odd run out has nothing to merge
+        if (r + 2 <= par->runs) b_end = par->bounds[r + 2];
+        size_t out = a;
+        while (a < a_end && b < b_end) {
+            if (parallel_entry_cmp(&par->src[b], &par->src[a]) < 0) {
+                par->dst[out++] = par->src[b++];
+            } else {
+                par->dst[out++] = par->src[a++];
+            }
+            if (out % PARALLEL_CHECK_INTERVAL == 0 && par->interrupted) {
+                return NULL;
+            }
+        }
+        memcpy(par->dst + out, par->src + a, (a_end - a) * sizeof(ENTRY));
+        out += a_end - a;
+        memcpy(par->dst + out, par->src + b, (b_end - b) * sizeof(ENTRY));
+    }
+    return NULL;
+}
+
+static void *
+parallel_sort_nogvl(void *ptr)
+{
+    parallel_t *par = ptr;
+    if (!par->sorted_runs) {
+        parallel_each(par, par->runs, 1, parallel_sort_runs);
+        if (par->interrupted) return NULL;
+        par->sorted_runs = 1;
+    }
+    while (1 < par->runs) {
+        size_t pairs = (par->runs + 1) / 2;
+        ENTRY *swap;
+        parallel_each(par, pairs, 1, parallel_merge_pairs);
+        if (par->interrupted) return NULL;
+        for (size_t i = 1; i <= pairs; ++i) {
+            size_t end     = i * 2 <= par->runs ? i * 2 : par->runs;
+            par->bounds[i] = par->bounds[end];
+        }
+        par->runs = pairs;
+        swap      = par->src;
+        par->src  = par->dst;
+        par->dst  = swap;
+    }
+    par->done = 1;
+    return NULL;
+}
+
+/*
+ * Sorts len entries (whose values are indexes) by score, using tmp as a second
+ * buffer of the same length.  Returns whichever of the two buffers holds the
+ * sorted entries.
+ */
+ENTRY *
+dheap_parallel_sort(ENTRY *entries, ENTRY *tmp, size_t len, int threads)
+{
+    parallel_t par;
+    VALUE      boundsv = 0;
+    MEMZERO(&par, parallel_t, 1);
+    par.threads = threads;
+    par.src     = entries;
+    par.dst     = tmp;
+    par.runs    = (len + PARALLEL_MAX_RUN - 1) / PARALLEL_MAX_RUN;
+    if (par.runs < (size_t)threads) {
+        par.runs = threads;
+        if (len / PARALLEL_MIN_CHUNK < par.runs) {
+            par.runs = len / PARALLEL_MIN_CHUNK;
+        }
+    }
+    if (par.runs < 1) par.runs = 1;
+    par.bounds = ALLOCV_N(size_t, boundsv, par.runs + 1);
+    for (size_t i = 0; i <= par.runs; ++i) {
+        par.bounds[i] = len * i / par.runs;
+    }
+    parallel_run(&par, parallel_sort_nogvl);
+    ALLOCV_END(boundsv);
+    return par.src;
+}
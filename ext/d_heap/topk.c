@@ -0,0 +1,235 @@
+#include "ruby.h"
+#include <string.h>
+
+#include "d_heap.h"
+
+/********************************************************************
+ *
+ * Top-k selection:  DHeap.nsmallest and DHeap.nlargest
+ *
+ * A bounded heap of the best k candidates so far, using the same sift macros as
+ * DHeap.  Its root is the worst of them:  the k-th score, which every other
+ * candidate is compared against.  Keys are negated for nsmallest, so the heap
+ * is always a min-heap, and a candidate is only sifted in when its key is
+ * greater than the root's.  When k is small relative to N, nearly every
+ * candidate is rejected by that single comparison.
+ *
+ * Entries hold a slot index into the "kept" Array (which keeps the candidates
+ * visible to GC), and the slot is reused when its candidate is evicted.  The
+ * entries grow as candidates arrive, so a huge k doesn't allocate up front for
+ * a source of unknown size.
+ *
+ ********************************************************************/
+
+#define DHEAP_SET_topk(heap, index, entry) /* noop */
+#define DHEAP_PAGED_topk                   0
+
+// packed doubles are scanned in chunks, without branching inside each chunk,
+// so the compiler can vectorize the threshold comparisons.
+#define TOPK_CHUNK 8
+
+// the initial capacity, when the source's size isn't known
+#define TOPK_INITIAL_CAPA 1024
+
+static ID id_each;
+static ID id_call;
+
+typedef struct topk
+{
+    dheap_t heap;
+    size_t  k;
+    double  sign; // -1.0 for nsmallest, 1.0 for nlargest
+    VALUE   by;
+    VALUE   kept;
+    VALUE   source;
+    int     packed;
+} topk_t;
+
+static void
+topk_grow(dheap_t *heap, size_t k)
+{
+    size_t capa = heap->capa * 2;
+    if (k < capa) capa = k;
+    REALLOC_N(heap->entries, ENTRY, capa);
+    heap->capa = capa;
+}
+
+static inline void
+topk_offer(topk_t *tk, SCORE key, VALUE value)
+{
+    dheap_t *heap = &tk->heap;
+    ENTRY    entry;
+    if (heap->size < tk->k) {
+        if (UNLIKELY(heap->size == heap->capa)) topk_grow(heap, tk->k);
+        entry.score = key;
+        entry.value = heap->size;
+        rb_ary_store(tk->kept, heap->size, value);
+        DHEAP_SET(topk, heap, heap->size, entry);
+        ++heap->size;
+        DHEAP_SIFT_UP(topk, heap, DHEAP_IDX_LAST(heap));
+    } else if (CMP_LT(DHEAP_SCORE(heap, 0), key)) {
+        rb_ary_store(tk->kept, DHEAP_VALUE(heap, 0), value);
+        DHEAP_SCORE(heap, 0) = key;
+        DHEAP_SIFT_DOWN(topk, heap, 0);
+    }
+}
+
+static inline SCORE
+topk_key(topk_t *tk, VALUE elem)
+{
+    VALUE score = NIL_P(tk->by) ? elem : rb_funcallv(tk->by, id_call, 1, &elem);
+    if (RB_FIXNUM_P(score)) return tk->sign * (SCORE)FIX2LONG(score);
+    return tk->sign * VAL2SCORE(score);
+}
+
+static void
+topk_array(topk_t *tk, VALUE ary)
+{
+    for (long i = 0; i < RARRAY_LEN(ary); ++i) {
+        VALUE elem = RARRAY_AREF(ary, i);
+        topk_offer(tk, topk_key(tk, elem), elem);
+    }
+}
+
+// Packed native doubles, e.g. from Array#pack("D*").  The kept values are the
+// scores themselves.
+static void
+topk_packed(topk_t *tk, VALUE str)
+{
+    const char *ptr = RSTRING_PTR(str);
+    size_t      len = RSTRING_LEN(str) / sizeof(double);
+    double      sign = tk->sign, chunk[TOPK_CHUNK];
+    size_t      i    = 0;
+    for (; i < len && tk->heap.size < tk->k; ++i) {
+        double x;
+        memcpy(&x, ptr + i * sizeof(double), sizeof(double));
+        topk_offer(tk, sign * x, Qnil);
+    }
+    for (; i + TOPK_CHUNK <= len; i += TOPK_CHUNK) {
+        double threshold = DHEAP_SCORE(&tk->heap, 0);
+        int    any       = 0;
+        memcpy(chunk, ptr + i * sizeof(double), sizeof(chunk));
+        for (int j = 0; j < TOPK_CHUNK; ++j) {
+            any |= CMP_LT(threshold, sign * chunk[j]);
+        }
+        if (LIKELY(!any)) continue;
+        for (int j = 0; j < TOPK_CHUNK; ++j) {
+            topk_offer(tk, sign * chunk[j], Qnil);
+        }
+    }
+    for (; i < len; ++i) {
+        double x;
+        memcpy(&x, ptr + i * sizeof(double), sizeof(double));
+        topk_offer(tk, sign * x, Qnil);
+    }
+}
+
+static VALUE
+topk_each_i(RB_BLOCK_CALL_FUNC_ARGLIST(elem, data))
+{
+    topk_t *tk = (topk_t *)data;
+    topk_offer(tk, topk_key(tk, elem), elem);
+    return Qnil;
+}
+
+// Selects the top k, then heapsorts them into the result.
+static VALUE
+topk_select(VALUE ptr)
+{
+    topk_t  *tk   = (topk_t *)ptr;
+    dheap_t *heap = &tk->heap;
+    VALUE    result;
+    size_t   n;
+    if (RB_TYPE_P(tk->source, T_ARRAY)) {
+        topk_array(tk, tk->source);
+    } else if (tk->packed) {
+        topk_packed(tk, tk->source);
+    } else {
+        rb_block_call(tk->source, id_each, 0, NULL, topk_each_i, (VALUE)tk);
+    }
+
+    // heapsort:  the root is the worst, so it's moved to the end each time.
+    n      = heap->size;
+    result = rb_ary_new_capa(n);
+    while (1 < heap->size) {
+        ENTRY root = DHEAP_GET(heap, 0);
+        DHEAP_GET(heap, 0) = DHEAP_GET(heap, DHEAP_IDX_LAST(heap));
+        DHEAP_GET(heap, DHEAP_IDX_LAST(heap)) = root;
+        --heap->size;
+        DHEAP_SIFT_DOWN(topk, heap, 0);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        ENTRY entry = DHEAP_GET(heap, i);
+        rb_ary_push(result,
+                    tk->packed ? SCORE2NUM(tk->sign * entry.score)
+                               : RARRAY_AREF(tk->kept, entry.value));
+    }
+    return result;
+}
+
+// Always runs, even when #each or by: raised.
+static VALUE
+topk_free(VALUE ptr)
+{
+    topk_t *tk = (topk_t *)ptr;
+    xfree(tk->heap.entries);
+    tk->heap.entries = NULL;
+    return Qnil;
+}
+
+/* @!visibility private */
+static VALUE
+dheap_s_topk(VALUE klass, VALUE k_val, VALUE source, VALUE by, VALUE largest)
+{
+    topk_t tk;
+    VALUE  result;
+    long   k = NUM2LONG(k_val);
+    int    packed;
+
+    if (k < 0) rb_raise(rb_eArgError, "negative size (%ld)", k);
+    packed = RB_TYPE_P(source, T_STRING);
+    if (packed && RSTRING_LEN(source) % sizeof(double)) {
+        rb_raise(rb_eArgError,
+                 "packed String length %ld isn't a multiple of %zu",
+                 RSTRING_LEN(source),
+                 sizeof(double));
+    }
+    if (packed && !NIL_P(by)) {
+        rb_raise(rb_eArgError, "by: can't be used with packed Strings");
+    }
+    // don't allocate more than the source could fill
+    if (RB_TYPE_P(source, T_ARRAY) && RARRAY_LEN(source) < k) {
+        k = RARRAY_LEN(source);
+    } else if (packed && (long)(RSTRING_LEN(source) / sizeof(double)) < k) {
+        k = RSTRING_LEN(source) / sizeof(double);
+    }
+    if (!k) return rb_ary_new();
+    MEMZERO(&tk, topk_t, 1);
+    tk.k      = k;
+    tk.sign   = RTEST(largest) ? 1.0 : -1.0;
+    tk.by     = by;
+    tk.source = source;
+    tk.packed = packed;
+    tk.heap.d = DHEAP_DEFAULT_D;
+    // Arrays and packed Strings have a known size (and k was capped to it)
+    tk.heap.capa =
+      (RB_TYPE_P(source, T_ARRAY) || packed || k < TOPK_INITIAL_CAPA)
+        ? (size_t)k
+        : TOPK_INITIAL_CAPA;
+    tk.kept         = rb_ary_new_capa(tk.heap.capa);
+    tk.heap.entries = ALLOC_N(ENTRY, tk.heap.capa);
+    result          = rb_ensure(topk_select, (VALUE)&tk, topk_free, (VALUE)&tk);
+    RB_GC_GUARD(tk.kept);
+    RB_GC_GUARD(source);
+    return result;
+}
+
+void
+Init_d_heap_topk(VALUE rb_cDHeap)
+{
+    id_each = rb_intern_const("each");
+    id_call = rb_intern_const("call");
+
+    rb_define_private_method(
+      rb_singleton_class(rb_cDHeap), "__topk__", dheap_s_topk, 4);
+}
@@ -2,6 +2,8 @@
 
 require "d_heap/d_heap"
 require "d_heap/version"
+require "d_heap/trace"
+require "d_heap/spill"
 
 # A fast _d_-ary heap implementation for ruby, useful in priority queues and graph
 # algorithms.
@@ -78,18 +80,192 @@ class DHeap
 
   # Initialize a _d_-ary min-heap.
   #
-  # @param d [Integer] Number of children for each parent node.
+  # @param d [Integer, :auto] Number of children for each parent node.
   #          Higher values generally speed up push but slow down pop.
   #          If all pushes are popped, the default is probably best.
+  #          With +:auto+, the mix of pushes, pops, and rescores is sampled
+  #          and the heap is rebuilt in place whenever a different d is
+  #          predicted to be significantly faster.  See {#d}.
   # @param capacity [Integer] initial capacity of the heap.
-  def initialize(d: DEFAULT_D, capacity: DEFAULT_CAPA) # rubocop:disable Naming/MethodParameterName
+  # @param stats [Boolean] collect operation counters, see {#stats}.  Requires
+  #          the extension to be compiled with +--enable-stats+.
+  # @param buffered [Boolean] append pushes to an unsorted buffer, which is
+  #          folded in before the next peek or pop.  See {#buffered=}.
+  # @param layout [:flat, :paged] how the tree is laid out in memory.  The
+  #          default +:flat+ layout is the classic implicit array.  +:paged+
+  #          packs several levels of each subtree into a single 4KiB page (a
+  #          "B-heap"), so that sift-down touches fewer pages.  This can be
+  #          faster for heaps much larger than the CPU's caches, but the extra
+  #          index math is slower for smaller heaps.
+  # @param memory_limit [Integer, nil] the most bytes of entries to hold in
+  #          memory.  Beyond this, the largest entries are spilled to sorted
+  #          temp files and merged back as they are popped.  See {DHeap::Spill}.
+  # @param dumper [#dump, #load] serializes spilled values.
+  # @param spill_dir [String, nil] where to create the temp files.
+  def initialize(d: DEFAULT_D, capacity: DEFAULT_CAPA, stats: false, buffered: false, # rubocop:disable Naming/MethodParameterName
+                 layout: :flat, memory_limit: nil, dumper: Marshal, spill_dir: nil)
     __init_without_kw__(d, capacity, false)
+    __init_stats__ if stats
+    __init_layout__(layout) unless layout == :flat
+    self.buffered = true if buffered
+    return unless memory_limit
+    extend Spill
+    __init_spill__(memory_limit, dumper, spill_dir)
+  end
+
+  # Runs Dijkstra's shortest paths algorithm entirely in C, on an internal
+  # _d_-ary heap of node indexes with decrease-key.  The GVL is released during
+  # the search, so other threads can run (and the search can be interrupted).
+  #
+  # The graph is given in CSR (compressed sparse row) form, with nodes numbered
+  # from 0 to +offsets.size - 2+.  Node +u+'s edges are the indexes from
+  # <tt>offsets[u]</tt> up to (not including) <tt>offsets[u + 1]</tt> into
+  # +targets+ and +weights+.  Each input may be an Array or a packed String:
+  # <tt>pack("Q*")</tt> for +offsets+ and +targets+, <tt>pack("D*")</tt> for
+  # +weights+.  Packed Strings are used without copying (and are locked while
+  # in use).  Weights must not be negative.
+  #
+  # Time complexity: <b>O(m + n d log n / log d)</b>, for +m+ edges and +n+
+  # nodes.  Unlike with DHeap::Map, each edge relaxation costs no allocations,
+  # hash operations, or ruby method calls.
+  #
+  # @example Shortest paths from node 0
+  #     # 0 --1.0--> 1 --2.0--> 2
+  #     #  \______________5.0___/^
+  #     offsets = [0, 2, 3, 3]
+  #     targets = [1, 2, 2]
+  #     weights = [1.0, 5.0, 2.0]
+  #     dist, pred = DHeap.dijkstra(offsets, targets, weights, 0)
+  #     dist # => [0.0, 1.0, 3.0]
+  #     pred # => [nil, 0, 1]
+  #
+  # @param offsets [Array<Integer>, String] <tt>n + 1</tt> edge offsets
+  # @param targets [Array<Integer>, String] each edge's target node
+  # @param weights [Array<Numeric>, String] each edge's weight
+  # @param source [Integer] the node to search from
+  # @param target [Integer, nil] stop searching once this node's distance is
+  #        known.  Other nodes' distances may then be incomplete.
+  # @param d [Integer] the heap's _d_
+  #
+  # @return [Array(Array<Float>, Array<Integer, nil>)] each node's distance from
+  #   +source+ (+Float::INFINITY+ if unreachable) and its predecessor on a
+  #   shortest path (+nil+ for +source+ and unreachable nodes).
+  def self.dijkstra(offsets, targets, weights, source, target: nil, d: DEFAULT_D) # rubocop:disable Naming/MethodParameterName
+    __dijkstra__(offsets, targets, weights, source, target, d)
+  end
+
+  # Merges already sorted sources into one sorted stream, in C, with a loser
+  # tree (tournament tree) over the sources' current elements.
+  #
+  # Arrays are read by index and, without +by+, their elements are compared as
+  # scores entirely in C:  about <tt>log2 k</tt> comparisons per element, for
+  # +k+ sources, with no ruby method calls.  Enumerators are read with +#next+,
+  # and any other Enumerable with +#to_enum+.  Equal scores are merged in
+  # source order, so the merge is stable.
+  #
+  # Each source must already be sorted by score.  This isn't checked.
+  #
+  # @example Merging sorted pages
+  #     DHeap.merge_sorted([[1, 4, 9], [2, 3], [5]])
+  #     # => [1, 2, 3, 4, 5, 9]
+  #     DHeap.merge_sorted(pages, by: :created_at, batch_size: 100) do |batch|
+  #       output.write(batch)
+  #     end
+  #
+  # @param sources [Array<Array, Enumerator, Enumerable>] sorted sources
+  # @param by [Proc, Symbol, nil] converts each element into its score.  By
+  #        default, the elements are their own scores.
+  # @param batch_size [Integer] the size of each yielded batch
+  #
+  # @yieldparam batch [Array] up to +batch_size+ merged elements
+  # @return [Array] all merged elements, when no block is given
+  # @return [nil] when a block is given
+  def self.merge_sorted(sources, by: nil, batch_size: 1024, &block)
+    sources = sources.map {|src|
+      src.is_a?(Array) || src.is_a?(Enumerator) ? src : src.to_enum
+    }
+    by = by.to_proc if by.is_a?(Symbol)
+    __merge_sorted__(sources, by, batch_size, &block)
+  end
+
+  # Selects the +k+ elements with the smallest scores, in a bounded heap in C.
+  #
+  # Only the best +k+ candidates so far are kept, and each new candidate is
+  # first compared against the k-th best score.  So for +N+ elements the worst
+  # case is <b>O(N log k)</b>, but most candidates are rejected with a single
+  # comparison, and there is no ruby method dispatch per element for an Array
+  # (without +by+).  This is much faster than <tt>sort.first(k)</tt> or
+  # <tt>min(k)</tt> when +k+ is small relative to +N+.
+  #
+  # The source can also be a String of packed native doubles, e.g. from
+  # <tt>pack("D*")</tt>, which is scanned in branch-free chunks.  The selected
+  # scores are returned as Floats.
+  #
+  # When several elements have the same score as the k-th smallest, which of
+  # them are selected is unspecified.
+  #
+  # @example
+  #     DHeap.nsmallest(3, [5, 1, 4, 2, 3])       # => [1, 2, 3]
+  #     DHeap.nsmallest(2, %w[ccc a bb], by: :size) # => ["a", "bb"]
+  #
+  # @param k [Integer] the maximum number of elements to select
+  # @param source [Array, Enumerable, String] elements (or packed doubles)
+  # @param by [Proc, Symbol, nil] converts each element into its score.  By
+  #        default, the elements are their own scores.
+  #
+  # @return [Array] up to +k+ elements, sorted by score (ascending)
+  def self.nsmallest(k, source, by: nil) # rubocop:disable Naming/MethodParameterName
+    by = by.to_proc if by.is_a?(Symbol)
+    __topk__(k, source, by, false)
+  end
+
+  # Selects the +k+ elements with the largest scores.
+  #
+  # @see DHeap.nsmallest
+  #
+  # @param (see DHeap.nsmallest)
+  # @return [Array] up to +k+ elements, sorted by score (descending)
+  def self.nlargest(k, source, by: nil) # rubocop:disable Naming/MethodParameterName
+    by = by.to_proc if by.is_a?(Symbol)
+    __topk__(k, source, by, true)
+  end
+
+  # Creates a heap from packed scores and their values, e.g. from
+  # {#scores_buffer} and {#values}, with a single <b>O(n)</b> heapify.  No
+  # objects are allocated per entry.
+  #
+  # Large batches are heapified in C without the GVL, so other threads can run
+  # meanwhile, and the heapify can be split between +threads+ native threads.
+  # Each level of the tree is split between the threads, so this is only
+  # parallel for the default <tt>layout: :flat</tt>.  Threads are only worth
+  # using for very large batches (millions of scores).
+  #
+  # @example Snapshot and restore
+  #     scores, values = heap.scores_buffer, heap.values
+  #     copy = DHeap.from_buffer(scores, values)
+  #
+  # @example Numeric scores, which are also the values
+  #     heap = DHeap.from_buffer(latencies, threads: 4)
+  #
+  # @param scores [String, IO::Buffer, Array<Numeric>] packed native doubles, as
+  #        from <tt>pack("D*")</tt>, or an Array of scores
+  # @param values [Array, nil] one value for each score.  When +nil+, the scores
+  #        are also the values (as Floats, for packed scores).
+  # @param threads [Integer] the maximum number of native threads to heapify
+  #        with (including the calling thread)
+  # @param options [Hash] passed to {#initialize}
+  #
+  # @return [DHeap]
+  def self.from_buffer(scores, values = nil, threads: 1, **options)
+    scores = scores.get_string if defined?(IO::Buffer) && scores.is_a?(IO::Buffer)
+    new(**options).__send__(:__load_buffer__, scores, values, threads)
   end
 
   # Consumes the heap by popping each minumum value until it is empty.
   #
   # If you want to iterate over the heap without consuming it, you will need to
-  # first call +#dup+
+  # first call +#dup+.  Copies are copy-on-write:  +#dup+ is <b>O(1)</b>, and
+  # the entries are only copied when either heap is first modified.
   #
   # @param with_score [Boolean] if scores shoul also be yielded
   #
@@ -108,6 +284,58 @@ class DHeap
     nil
   end
 
+  # Removes every value, and returns them in the order they would be popped.
+  #
+  # Unlike {#each_pop}, this sorts in C, without the GVL, so other threads can
+  # run meanwhile, and the sort can be split between +threads+ native threads.
+  # Values that other threads push while it sorts aren't drained; they remain in
+  # the heap.  Values with equal scores may be returned in a different order than
+  # #pop would return them.
+  #
+  # Time complexity: <b>O(n log n)</b>
+  #
+  # @param threads [Integer] the maximum number of native threads to sort with
+  #        (including the calling thread)
+  #
+  # @return [Array<Object>]
+  def drain_sorted(threads: 1)
+    __drain_sorted__(threads)
+  end
+
+  # A _d_-ary max-heap:  values with the largest scores are peeked and popped
+  # first.
+  #
+  # Scores are stored negated, so the same sift code runs for both min-heaps and
+  # max-heaps, without any extra comparisons or branches.  Scores are converted
+  # back when they're returned, e.g. by {#peek_score} and {#pop_with_score}, so
+  # no negation is needed in ruby.
+  #
+  # The min-heap's conditional pops are replaced by {#pop_gt}, {#pop_gte}, and
+  # {#pop_all_above}.  Max-heaps can't use +memory_limit+, and can't be traced.
+  #
+  # @example
+  #     heap = DHeap::Max.new
+  #     heap.push(:low, 1)
+  #     heap.push(:high, 10)
+  #     heap.peek_score  # => 10.0
+  #     heap.pop_gte(5)  # => :high
+  #     heap.pop_gte(5)  # => nil
+  class Max
+    undef_method :pop_lt, :pop_lte, :pop_all_below, :pop_all_lt, :pop_below,
+                 :pop_due, :next_timeout, :trace_to
+
+    alias pop_all_gt pop_all_above
+    alias pop_above  pop_gt
+
+    # Initialize a _d_-ary max-heap.
+    #
+    # @param (see DHeap#initialize)
+    def initialize(d: DEFAULT_D, capacity: DEFAULT_CAPA, stats: false, buffered: false, # rubocop:disable Naming/MethodParameterName
+                   layout: :flat)
+      super
+    end
+  end
+
   if defined?(Map)
 
     # Unlike {DHeap}, an object can only be added into a {DHeap::Map} once.  Any
@@ -120,12 +348,20 @@ class DHeap
 
       # Initialize a _d_-ary min-heap which can map objects to scores.
       #
-      # @param d [Integer] Number of children for each parent node.
+      # @param d [Integer, :auto] Number of children for each parent node.
       #          Higher values generally speed up push but slow down pop.
       #          If all pushes are popped, the default is probably best.
+      #          See {DHeap#initialize} for +:auto+.
       # @param capacity [Integer] initial capacity of the heap.
-      def initialize(d: DEFAULT_D, capacity: DEFAULT_CAPA) # rubocop:disable Naming/MethodParameterName
+      # @param stats [Boolean] collect operation counters, see {DHeap#stats}.
+      # @param buffered [Boolean] buffer pushes, see {DHeap#buffered=}.
+      # @param layout [:flat, :paged] see {DHeap#initialize}.
+      def initialize(d: DEFAULT_D, capacity: DEFAULT_CAPA, stats: false, buffered: false, # rubocop:disable Naming/MethodParameterName
+                     layout: :flat)
         __init_without_kw__(d, capacity, true)
+        __init_stats__ if stats
+        __init_layout__(layout) unless layout == :flat
+        self.buffered = true if buffered
       end
 
     end
@@ -45,6 +45,11 @@ module DHeap::Benchmarks
       @a.push score
     end
 
+    # O(n)
+    def peek
+      @a.min
+    end
+
     # O(n)
     def pop
       return unless (score = @a.min)
@@ -70,6 +75,11 @@ module DHeap::Benchmarks
       @a[score] += 1
     end
 
+    # O(n)
+    def peek
+      @a.keys.min
+    end
+
     # O(n)
     def pop
       return unless (obj = @a.keys.min)
@@ -90,6 +100,11 @@ module DHeap::Benchmarks
       @a.sort!
     end
 
+    # O(1)
+    def peek
+      @a.first
+    end
+
     # O(1)
     def pop
       @a.shift
@@ -125,6 +140,10 @@ module DHeap::Benchmarks
       @a.pop
     end
 
+    def peek
+      @a.last
+    end
+
   end
 
   # a very simple pure ruby binary heap
@@ -177,6 +196,10 @@ module DHeap::Benchmarks
 
     # rubocop:enable Metrics/MethodLength, Metrics/AbcSize
 
+    def peek
+      @a.first
+    end
+
     private
 
     def check_heap!(idx)
@@ -227,6 +250,12 @@ module DHeap::Benchmarks
     def empty?; @q.empty? end
     def size;   @q.size   end
 
+    def peek
+      @q.top
+    rescue RuntimeError
+      nil
+    end
+
     def pop
       @q.pop
     rescue RuntimeError
@@ -0,0 +1,285 @@
+# frozen_string_literal: true
+
+require "d_heap/benchmarks"
+require "d_heap/benchmarks/record"
+
+require "fileutils"
+require "objspace"
+
+module DHeap::Benchmarks
+
+  # Measures memory rather than speed:  objects allocated per op, GC time per
+  # op, and peak RSS growth for each scenario, plus the bytes that are retained
+  # by a queue holding N items.
+  #
+  # An "op" is a single push or pop.  Each measurement runs in a forked child
+  # process (when fork is available), so one measurement's garbage and heap
+  # growth can't affect the next, and so peak RSS can be reset and read from
+  # <tt>/proc/self</tt>.  Peak RSS is only measured on linux.
+  #
+  # Each scenario gets its own output directory, containing results.yml for
+  # allocations, gc_time.yml, and peak_rss.yml.  The "memsize" directory's
+  # results.yml holds <tt>ObjectSpace.memsize_of</tt> the queue and everything
+  # reachable from it.  Jobs are implementation names and contexts are
+  # "N #{n}", just like the push_pop benchmarks.
+  class Memory
+    include Randomness
+    include Scenarios
+
+    # The scenarios that every implementation runs, and those that only run on
+    # DHeap or DHeap::Map.
+    SCENARIOS = %w[
+      push_n push_n_pop_n push_pop pop_with_score map_churn memsize
+    ].freeze
+
+    N_VALS = [
+      10, 100, 1000, 10_000, 100_000, 1_000_000, 10_000_000
+    ].freeze
+
+    # Larger N are skipped for the O(n) implementations.
+    MAX_N = {
+      Sorting  => 3_000,
+      FindMin  => 10_000,
+      FindHash => 10_000,
+      BSearch  => 100_000,
+    }.freeze
+
+    Job = Struct.new(:name, :klass)
+
+    attr_reader :output_dir, :scenarios, :implementations, :n_vals
+    attr_reader :iterations, :repeat_count, :io
+
+    def initialize(output_dir: nil,
+                   scenarios: SCENARIOS,
+                   implementations: IMPLEMENTATIONS,
+                   n_vals: N_VALS,
+                   iterations: 100_000,
+                   repeat_count: Integer(ENV.fetch("BENCHMARK_REPEATS", 4)),
+                   io: $stdout)
+      @output_dir      = output_dir
+      @scenarios       = scenarios.map(&:to_s)
+      @implementations = implementations
+      @n_vals          = n_vals.map {|n| Integer(n) }
+      @iterations      = Integer(iterations)
+      @repeat_count    = Integer(repeat_count)
+      @io              = io
+    end
+
+    # @return [Hash{String => Hash{String => Hash{String => Array<Hash>}}}]
+    #   scenario => job name => context => one hash per repeated measurement
+    def call
+      DHeap::Benchmarks.puts_version_info("Memory benchmarks", io)
+      fill_random_vals(io: io)
+      results = scenarios.map {|scenario| [scenario, run(scenario)] }.to_h
+      write_results(results) if output_dir
+      results
+    end
+
+    def run(scenario)
+      io.puts "== #{scenario}"
+      io.puts header
+      jobs_for(scenario).each_with_object({}) do |job, results|
+        n_vals.each do |n|
+          next if MAX_N.fetch(job.klass, n) < n
+          measurements = Array.new(repeat_count) {
+            isolated { measure(scenario, job, n) }
+          }
+          io.puts row(job, n, measurements)
+          (results[job.name] ||= {})["N #{n}"] = measurements
+        end
+      end
+    end
+
+    def jobs_for(scenario)
+      case scenario
+      when "pop_with_score" then [Job.new("DHeap", DHeap), map_job].compact
+      when "map_churn"      then [map_job].compact
+      else
+        implementations.map {|impl| Job.new(impl.name.strip, impl.klass) }
+      end
+    end
+
+    # @return [Hash] allocations, gc_time, and peak_rss are per op
+    def measure(scenario, job, size)
+      return { "memsize" => memsize(initq(job.klass, size)) } if scenario == "memsize"
+      prefill = scenario.start_with?("push_n") ? 0 : size
+      scenario = method(scenario)
+      # warms up inline caches, which are allocated by the first call
+      scenario.call(initq(job.klass, prefill.clamp(0, 1)), 1, 1)
+      queue = initq(job.klass, prefill)
+      GC.start
+      reset_peak_rss
+      rss       = read_status("VmRSS")
+      gc_time   = gc_time_ns
+      allocated = GC.stat(:total_allocated_objects)
+      ops       = scenario.call(queue, size, iterations)
+      allocated = GC.stat(:total_allocated_objects) - allocated
+      gc_time   = gc_time_ns - gc_time
+      peak      = read_status("VmHWM")
+      {
+        "allocations" => allocated.fdiv(ops),
+        "gc_time"     => gc_time.fdiv(ops),
+        "peak_rss"    => rss && peak && peak - rss,
+      }
+    end
+
+    # @return [Integer] bytes, for the queue and all objects reachable from it.
+    #   Modules and immediates aren't counted.
+    def memsize(queue)
+      seen = {}.compare_by_identity
+      pending = [queue]
+      total = 0
+      while (obj = pending.pop)
+        next if seen[obj] || obj.is_a?(Module)
+        seen[obj] = true
+        total += ObjectSpace.memsize_of(obj)
+        pending.concat(ObjectSpace.reachable_objects_from(obj) || [])
+      end
+      total
+    end
+
+    # @!group Scenarios (each returns the number of ops)
+
+    def push_n(queue, size, _iterations)
+      super(queue, size)
+      size
+    end
+
+    def push_n_pop_n(queue, size, _iterations)
+      push_n_then_pop_n(queue, size)
+      size * 2
+    end
+
+    def push_pop(queue, _size, iterations)
+      repeated_push_pop(queue, iterations)
+      iterations * 2
+    end
+
+    def pop_with_score(queue, _size, iterations)
+      count = iterations
+      while count.positive?
+        queue << random_val
+        queue.pop_with_score
+        count -= 1
+      end
+      iterations * 2
+    end
+
+    # Every push adds a new key to the map's index.
+    def map_churn(queue, size, iterations)
+      key = size
+      stop = size + iterations
+      while key < stop
+        queue[key] = random_val
+        queue.pop
+        key += 1
+      end
+      iterations * 2
+    end
+
+    # @!endgroup
+
+    private
+
+    def map_job
+      Job.new("DHeap::Map", DHeap::Map) if defined?(DHeap::Map)
+    end
+
+    # DHeap::Map is keyed by value, so it's filled with unique keys.
+    def initq(klass, count)
+      queue = klass.new
+      if defined?(DHeap::Map) && klass <= DHeap::Map
+        count.times do |key| queue[key] = random_val end
+      else
+        count.times do queue << random_val end
+      end
+      queue
+    end
+
+    # Runs the block in a forked child and returns its (marshaled) result.
+    def isolated
+      return yield unless Process.respond_to?(:fork)
+      reader, writer = IO.pipe
+      pid = fork do
+        reader.close
+        Marshal.dump(yield, writer)
+        writer.close
+        exit!(0)
+      end
+      writer.close
+      result = Marshal.load(reader) # rubocop:disable Security/MarshalLoad
+      reader.close
+      Process.wait(pid)
+      result
+    end
+
+    def gc_time_ns
+      return GC.stat(:time) * 1_000_000 if GC.stat.key?(:time)
+      GC::Profiler.enable
+      (GC::Profiler.total_time * 1_000_000_000).round
+    end
+
+    # Resets VmHWM to the current RSS.
+    def reset_peak_rss
+      File.write("/proc/self/clear_refs", "5")
+    rescue SystemCallError
+      nil
+    end
+
+    # @return [Integer, nil] bytes
+    def read_status(field)
+      status = File.read("/proc/self/status")
+      kb = status[/^#{field}:\s*(\d+) kB/, 1]
+      kb && Integer(kb) * 1024
+    rescue SystemCallError
+      nil
+    end
+
+    def header
+      format("%-20s %10s %12s %14s %14s %14s",
+             "implementation", "N", "allocs/op", "GC ns/op", "peak RSS", "memsize")
+    end
+
+    def row(job, size, measurements)
+      best = ->(key) { measurements.map {|m| m[key] }.compact.min }
+      format("%-20s %10d %12s %14s %14s %14s",
+             job.name, size,
+             *%w[allocations gc_time peak_rss memsize].map {|key|
+               value = best[key]
+               value.is_a?(Float) ? format("%.2f", value) : value.to_s
+             })
+    end
+
+    METRICS = {
+      "allocations" => ["results.yml", "Objects allocated per op", "objects"],
+      "gc_time"     => ["gc_time.yml", "GC time per op", "ns"],
+      "peak_rss"    => ["peak_rss.yml", "Peak RSS growth", "bytes"],
+      "memsize"     => ["results.yml", "Retained memsize", "bytes"],
+    }.freeze
+
+    # Writes one yml per metric into each scenario's dir, for bin/benchmark-driver.
+    # Metrics that couldn't be measured (e.g. peak RSS off linux) are skipped.
+    def write_results(results)
+      results.each do |scenario, jobs|
+        dir = File.join(output_dir, "memory_#{scenario}")
+        FileUtils.mkdir_p dir
+        METRICS.each do |key, (file, name, unit)|
+          values = collect(jobs, key)
+          next unless values
+          metric = Record.metric(name, unit, larger_better: false, worse_word: "more")
+          Record.write(File.join(dir, file), metric, values)
+        end
+      end
+    end
+
+    def collect(jobs, key)
+      values = jobs.transform_values {|contexts|
+        contexts.transform_values {|measurements| measurements.map {|m| m[key] } }
+      }
+      all = values.values.flat_map(&:values).flatten
+      values unless all.empty? || all.include?(nil)
+    end
+
+  end
+
+end
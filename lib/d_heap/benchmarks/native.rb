@@ -0,0 +1,171 @@
+# frozen_string_literal: true
+
+require "d_heap/benchmarks/record"
+
+require "English"
+require "fileutils"
+require "rbconfig"
+require "shellwords"
+
+module DHeap::Benchmarks
+
+  # Compiles and runs benchmarks/native/sift_bench.c, which benchmarks the
+  # extension's sift macros directly from C, without any ruby method dispatch.
+  #
+  # Each scenario and score distribution gets its own output directory, which
+  # contains a results.yml for iterations per second and one for each hardware
+  # counter that could be read.  Jobs are "d=#{d}" (with " paged" appended for
+  # <tt>layout: :paged</tt>) and contexts are "N #{n}", just like the
+  # d_push_pop benchmarks.
+  class Native
+
+    ROOT_DIR   = File.expand_path("../../..", __dir__)
+    SOURCE     = File.join(ROOT_DIR, "benchmarks/native/sift_bench.c")
+    EXT_DIR    = File.join(ROOT_DIR, "ext/d_heap")
+    EXECUTABLE = File.join(ROOT_DIR, "tmp/native/sift_bench")
+
+    SCENARIOS     = %w[push_pop push_n_pop_n].freeze
+    DISTRIBUTIONS = %w[random ascending descending clustered].freeze
+    D_VALS        = [2, 3, 4, 6, 8, 10, 12, 16, 24, 32].freeze
+    LAYOUTS       = %w[flat].freeze
+    N_VALS        = [
+      10, 100, 1000, 10_000, 100_000, 1_000_000, 10_000_000
+    ].freeze
+
+    COUNTERS = %w[
+      cycles instructions l1d_misses llc_misses branch_misses
+    ].freeze
+
+    attr_reader :output_dir, :scenarios, :distributions, :d_vals, :layouts
+    attr_reader :n_vals
+    attr_reader :iterations, :repeat_count, :io
+
+    def initialize(output_dir: "benchmarks/native/output",
+                   scenarios: SCENARIOS,
+                   distributions: DISTRIBUTIONS,
+                   d_vals: D_VALS,
+                   layouts: LAYOUTS,
+                   n_vals: N_VALS,
+                   iterations: 1_000_000,
+                   repeat_count: Integer(ENV.fetch("BENCHMARK_REPEATS", 4)),
+                   io: $stdout)
+      @output_dir    = output_dir
+      @scenarios     = scenarios
+      @distributions = distributions
+      @d_vals        = d_vals
+      @layouts       = layouts
+      @n_vals        = n_vals
+      @iterations    = Integer(iterations)
+      @repeat_count  = Integer(repeat_count)
+      @io            = io
+    end
+
+    def call
+      DHeap::Benchmarks.puts_version_info("Native benchmarks", io)
+      compile
+      write_results(run)
+    end
+
+    def compile
+      FileUtils.mkdir_p File.dirname(EXECUTABLE)
+      cmd = [*cc, *cflags, "-o", EXECUTABLE, SOURCE, "-lm"]
+      io.puts cmd.shelljoin
+      system(*cmd, exception: true)
+    end
+
+    # @return [Array<Hash>] one hash per measurement
+    def run
+      header = nil
+      lines = IO.popen(command, &:readlines)
+      raise "#{EXECUTABLE} failed: #{$CHILD_STATUS}" unless $CHILD_STATUS.success?
+      lines.each_with_object([]) do |line, rows|
+        fields = line.chomp.split("\t")
+        next header = fields unless header
+        io.puts line
+        rows << header.zip(fields).to_h
+      end
+    end
+
+    def command
+      [
+        EXECUTABLE,
+        "-s", scenarios.join(","),
+        "-D", distributions.join(","),
+        "-d", d_vals.join(","),
+        "-l", layouts.join(","),
+        "-n", n_vals.join(","),
+        "-i", iterations.to_s,
+        "-r", repeat_count.to_s,
+      ]
+    end
+
+    def write_results(rows)
+      rows.group_by {|row| row.values_at("scenario", "dist") }
+        .each do |(scenario, dist), measurements|
+          dir = File.join(output_dir, "native_#{scenario}_#{dist}")
+          FileUtils.mkdir_p dir
+          write_ips(dir, measurements)
+          COUNTERS.each do |counter| write_counter(dir, counter, measurements) end
+        end
+    end
+
+    private
+
+    def cc
+      Shellwords.split(ENV.fetch("CC", RbConfig::CONFIG["CC"]))
+    end
+
+    def cflags
+      %W[
+        -O3 -std=gnu99 -DNDEBUG
+        -I#{EXT_DIR}
+        -I#{RbConfig::CONFIG["rubyhdrdir"]}
+        -I#{RbConfig::CONFIG["rubyarchhdrdir"]}
+      ]
+    end
+
+    def write_ips(dir, measurements)
+      metric = Record.metric("Iteration per second", "i/s")
+      results = collect(measurements) {|row|
+        Float(row["loops"]) / Float(row["seconds"])
+      }
+      loop_counts = measurements
+        .map {|row| [job_and_context(row), Integer(row["loops"])] }
+        .to_h
+      durations = measurements
+        .group_by {|row| job_and_context(row) }
+        .map {|key, rows| [key, rows.map {|row| Float(row["seconds"]) }.min] }
+        .to_h
+      Record.write(File.join(dir, "results.yml"), metric, results,
+                   command: command,
+                   loop_counts: loop_counts,
+                   durations: durations)
+    end
+
+    def write_counter(dir, counter, measurements)
+      return if measurements.any? {|row| Integer(row[counter]).negative? }
+      metric = Record.metric("#{counter} per iteration", counter,
+                             larger_better: false, worse_word: "more")
+      results = collect(measurements) {|row|
+        Float(row[counter]) / Float(row["loops"])
+      }
+      Record.write(File.join(dir, "#{counter}.yml"), metric, results,
+                   command: command)
+    end
+
+    def collect(measurements)
+      measurements.each_with_object({}) do |row, results|
+        job, context = job_and_context(row)
+        ((results[job] ||= {})[context] ||= []) << yield(row)
+      end
+    end
+
+    def job_and_context(row)
+      job = "d=#{row["d"]}"
+      job += " #{row["layout"]}" unless row["layout"] == "flat"
+      [job, "N #{row["n"]}"]
+    end
+
+  end
+
+end
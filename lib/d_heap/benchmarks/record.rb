@@ -0,0 +1,79 @@
+# frozen_string_literal: true
+
+require "d_heap/benchmarks"
+
+require "benchmark_driver"
+require "yaml"
+
+module DHeap::Benchmarks
+
+  # Writes results that were measured outside of benchmark_driver into the same
+  # results.yml format as <tt>benchmark-driver --output record</tt>.  This lets
+  # <tt>bin/benchmark-driver results.yml -o gruff</tt> (or markdown, compare,
+  # etc) chart and compare them just like the other results in benchmarks/.
+  module Record
+
+    module_function
+
+    # @param path [String] where to write the results.yml
+    # @param metric [BenchmarkDriver::Metric] e.g. from {.metric}
+    # @param results [Hash{String => Hash{String => Array<Numeric>}}]
+    #   job name => context name => all measured values for that combination.
+    # @param command [Array<String>] recorded as each context's executable.
+    # @param loop_counts [Hash{Array(String, String) => Integer}]
+    #   optional [job, context] => loop count
+    # @param durations [Hash{Array(String, String) => Float}]
+    #   optional [job, context] => seconds
+    def write(path, metric, results, command: [], loop_counts: {}, durations: {})
+      job_results = results.each_with_object({}) do |(job, contexts), hash|
+        hash[BenchmarkDriver::Job.new(name: job)] = {
+          false => contexts.each_with_object({}) do |(context, values), ctxs|
+            key = [job, context]
+            ctxs[context_for(context, command)] =
+              result_for(metric, values, loop_counts[key], durations[key])
+          end,
+        }
+      end
+      File.write(path, YAML.dump(
+        "type" => "recorded",
+        "job_warmup_context_result" => job_results,
+        "metrics" => [metric]
+      ))
+      path
+    end
+
+    def metric(name, unit, larger_better: true, worse_word: nil)
+      BenchmarkDriver::Metric.new(
+        name: name,
+        unit: unit,
+        larger_better: larger_better,
+        worse_word: worse_word || (larger_better ? "slower" : "larger"),
+      )
+    end
+
+    def context_for(name, command)
+      @contexts ||= {}
+      @contexts[[name, command]] ||= BenchmarkDriver::Context.new(
+        name: name,
+        executable: BenchmarkDriver::Config::Executable.new(
+          name: name, command: command
+        ),
+        gems: {},
+        prelude: "",
+      )
+    end
+
+    def result_for(metric, values, loop_count, duration)
+      best = metric.larger_better ? values.max : values.min
+      BenchmarkDriver::Result.new(
+        values: { metric => best },
+        all_values: { metric => values },
+        duration: duration,
+        loop_count: loop_count,
+        environment: {},
+      )
+    end
+
+  end
+
+end
@@ -0,0 +1,198 @@
+# frozen_string_literal: true
+
+require "d_heap/benchmarks"
+require "d_heap/benchmarks/record"
+
+require "fileutils"
+
+module DHeap::Benchmarks
+
+  # Replays a trace that was recorded by DHeap#trace_to against each of the
+  # IMPLEMENTATIONS and against DHeap and DHeap::Map with different options.
+  #
+  # Each variant is replayed twice:  once to measure throughput (ops/sec for the
+  # whole trace), and once more to measure each operation's latency.  Timing
+  # every op adds the clock's overhead to each latency, but the percentiles are
+  # still useful for comparing variants.
+  #
+  # The example implementations only hold scores, so pushes are replayed as
+  # <tt>queue << score</tt> and the conditional pops are replayed with +peek+.
+  # Only DHeap::Map will treat a repeated id as a rescore, and only DHeap::Map
+  # replays deletes (the others can't find a value to delete, so they skip them).
+  class Replay
+    include DHeap::Trace
+
+    PERCENTILES = [50, 90, 99, 99.9].freeze
+
+    # DHeap and DHeap::Map are replayed once for each of these.
+    DHEAP_OPTIONS = [
+      { d: 2 },
+      { d: 4 },
+      { d: DHeap::DEFAULT_D },
+      { d: 8 },
+      { d: 16 },
+      { d: :auto },
+      { layout: :paged },
+      { d: 2, layout: :paged },
+    ].freeze
+
+    Variant = Struct.new(:name, :kind, :factory)
+    Measurement = Struct.new(:variant, :ops_per_sec, :latencies)
+
+    attr_reader :path, :output_dir, :implementations, :dheap_options
+    attr_reader :repeat_count, :io
+
+    def initialize(path,
+                   output_dir: nil,
+                   implementations: IMPLEMENTATIONS,
+                   dheap_options: DHEAP_OPTIONS,
+                   repeat_count: Integer(ENV.fetch("BENCHMARK_REPEATS", 4)),
+                   io: $stdout)
+      @path            = path
+      @output_dir      = output_dir
+      @implementations = implementations
+      @dheap_options   = dheap_options
+      @repeat_count    = Integer(repeat_count)
+      @io              = io
+      @ops, @scores, @ids = DHeap::Trace.load(path)
+    end
+
+    # @return [Array<Measurement>]
+    def call
+      DHeap::Benchmarks.puts_version_info("Trace replay", io)
+      io.puts "#{path}: #{@ops.bytesize} ops"
+      io.puts
+      io.puts header
+      measurements = variants.map {|variant|
+        measure(variant).tap {|measurement| io.puts row(measurement) }
+      }
+      write_results(measurements) if output_dir
+      measurements
+    end
+
+    def variants
+      examples = implementations
+        .reject {|impl| impl.klass <= DHeap }
+        .map {|impl| Variant.new(impl.name.strip, :example, -> { impl.klass.new }) }
+      examples + dheap_variants(DHeap, "DHeap") + dheap_variants(map_class, "Map")
+    end
+
+    def measure(variant)
+      ops_per_sec = Array.new(repeat_count) {
+        queue = variant.factory.call
+        GC.start
+        start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        replay(queue, variant.kind)
+        @ops.bytesize / (Process.clock_gettime(Process::CLOCK_MONOTONIC) - start)
+      }
+      Measurement.new(variant, ops_per_sec, latencies(variant))
+    end
+
+    # @return [Array<Integer>] sorted nanoseconds for each op
+    def latencies(variant)
+      queue = variant.factory.call
+      kind = variant.kind
+      GC.start
+      Array.new(@ops.bytesize) {|i|
+        start = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+        step(queue, kind, @ops.getbyte(i), @scores[i], @ids[i])
+        Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond) - start
+      }.sort!
+    end
+
+    def replay(queue, kind)
+      ops = @ops
+      scores = @scores
+      ids = @ids
+      i = 0
+      count = ops.bytesize
+      while i < count
+        step(queue, kind, ops.getbyte(i), scores[i], ids[i])
+        i += 1
+      end
+    end
+
+    # rubocop:disable Metrics/MethodLength, Metrics/CyclomaticComplexity
+
+    def step(queue, kind, op, score, id)
+      case op
+      when PUSH          then kind == :example ? queue << score : queue.push(id, score)
+      when POP           then queue.pop
+      when PEEK          then queue.peek
+      when CLEAR         then queue.clear
+      when DELETE        then kind == :map && queue.delete(id)
+      when POP_LT        then pop_cmp(queue, kind, :pop_lt, score)
+      when POP_LTE       then pop_cmp(queue, kind, :pop_lte, score)
+      when POP_ALL_BELOW
+        if kind == :example
+          queue.pop while (min = queue.peek) && min < score
+        else
+          queue.pop_all_below(score)
+        end
+      else
+        raise ArgumentError, "unknown trace op code: #{op}"
+      end
+    end
+
+    # rubocop:enable Metrics/MethodLength, Metrics/CyclomaticComplexity
+
+    def percentile(sorted, pct)
+      return 0 if sorted.empty?
+      sorted[((sorted.length - 1) * pct / 100.0).round]
+    end
+
+    private
+
+    def map_class
+      DHeap::Map if defined?(DHeap::Map)
+    end
+
+    def dheap_variants(klass, label)
+      return [] unless klass
+      kind = klass == DHeap ? :dheap : :map
+      dheap_options.map {|opts|
+        name = "#{label} #{opts.map {|k, v| "#{k}=#{v}" }.join(" ")}"
+        Variant.new(name, kind, -> { klass.new(**opts) })
+      }
+    end
+
+    def pop_cmp(queue, kind, method, score)
+      return queue.__send__(method, score) unless kind == :example
+      min = queue.peek
+      queue.pop if min && (method == :pop_lt ? min < score : min <= score)
+    end
+
+    def header
+      format("%-24s %14s %s",
+             "implementation", "ops/sec",
+             PERCENTILES.map {|pct| format("%10s", "p#{pct} ns") }.join)
+    end
+
+    def row(measurement)
+      format("%-24s %14.1f %s",
+             measurement.variant.name, measurement.ops_per_sec.max,
+             PERCENTILES.map {|pct|
+               format("%10d", percentile(measurement.latencies, pct))
+             }.join)
+    end
+
+    # Writes results.yml (ops/sec) and latency_p*.yml, for bin/benchmark-driver.
+    def write_results(measurements)
+      FileUtils.mkdir_p output_dir
+      context = File.basename(path)
+      ips = measurements.map {|m| [m.variant.name, { context => m.ops_per_sec }] }.to_h
+      Record.write(File.join(output_dir, "results.yml"),
+                   Record.metric("Iteration per second", "i/s"), ips)
+      PERCENTILES.each do |pct|
+        values = measurements.map {|m|
+          [m.variant.name, { context => [percentile(m.latencies, pct)] }]
+        }.to_h
+        metric = Record.metric("p#{pct} latency", "ns",
+                               larger_better: false, worse_word: "slower")
+        Record.write(File.join(output_dir, "latency_p#{pct}.yml"), metric, values)
+      end
+    end
+
+  end
+
+end
@@ -0,0 +1,370 @@
+# frozen_string_literal: true
+
+require "tempfile"
+
+class DHeap
+
+  # Bounds a heap's memory by spilling its largest entries to temp files.  It is
+  # extended onto heaps created with <tt>DHeap.new(memory_limit: bytes)</tt>.
+  #
+  # When a push would grow the in-memory heap past its limit, the in-memory
+  # entries are sorted and the largest half is written out as a "run": an
+  # unlinked temp file of score-sorted entries, with values serialized by the
+  # dumper.  Only the head of each run is kept in memory, in a small heap of
+  # runs.  Pops take whichever is smaller: the in-memory minimum or the smallest
+  # run head.  So runs are merged back lazily, reading each file sequentially.
+  #
+  # Runs are grouped into levels, like a sequence heap:  spilled runs start on
+  # level 0, and once a level has MERGE_WIDTH unexhausted runs, they are merged
+  # into one run on the next level.  Only runs of similar sizes are merged, so
+  # each entry is rewritten O(log n) times, and the number of open files only
+  # grows with the number of levels.
+  #
+  # Values must be serializable by the dumper (Marshal, by default), and values
+  # that were spilled will be popped as copies of the original objects.
+  module Spill
+    # sizeof(ENTRY): a double score and a VALUE.  Only entries are counted,
+    # not the objects they refer to.
+    ENTRY_SIZE = 16
+
+    # The number of runs on one level that are merged together.
+    MERGE_WIDTH = 16
+
+    # A sorted run of spilled entries, read sequentially from a temp file.
+    #
+    # Each record is a float64-le score and a uint32-le length, followed by the
+    # dumped value.
+    class Run
+      HEADER      = "EL<"
+      HEADER_SIZE = 12
+
+      # @return [Float] the score of the run's head
+      attr_reader :score
+
+      # @return [Object] the run's head
+      attr_reader :value
+
+      # @return [Integer] the number of entries after the head
+      attr_reader :remaining
+
+      def self.tempfile(dir)
+        Tempfile.new("d_heap-run", dir, binmode: true).tap(&:unlink)
+      end
+
+      # @param values [Array] sorted (with scores) in ascending order
+      # @param scores [Array<Float>] sorted in ascending order
+      def self.write(dumper, dir, values, scores)
+        file = tempfile(dir)
+        values.each_with_index do |value, i|
+          dumped = dumper.dump(value)
+          file.write([scores[i], dumped.bytesize].pack(HEADER), dumped)
+        end
+        new(file, values.size, dumper)
+      end
+
+      def initialize(file, count, dumper)
+        @file      = file
+        @remaining = count
+        @dumper    = dumper
+        @file.flush
+        @file.rewind
+        advance
+      end
+
+      # Reads the next entry into #score and #value.
+      # @return [Boolean] false when the run is exhausted (and closed)
+      def advance
+        if @remaining.zero?
+          close
+          return false
+        end
+        @remaining -= 1
+        @header = @file.read(HEADER_SIZE)
+        @score, bytesize = @header.unpack(HEADER)
+        @dumped = @file.read(bytesize)
+        @value = @dumper.load(@dumped)
+        true
+      end
+
+      # Copies the head's record to another run's file, without re-dumping it.
+      def write_head_to(file)
+        file.write(@header, @dumped)
+      end
+
+      # @return [Array<Array(Object, Float)>] the remaining entries, without
+      #   advancing the run
+      def peek_remaining
+        pos = @file.pos
+        Array.new(@remaining) {
+          score, bytesize = @file.read(HEADER_SIZE).unpack(HEADER)
+          [@dumper.load(@file.read(bytesize)), score]
+        }
+      ensure
+        @file.pos = pos
+      end
+
+      def closed?
+        @file.closed?
+      end
+
+      def close
+        @score = @value = @header = @dumped = nil
+        @file.close unless @file.closed?
+      end
+    end
+
+    # @!visibility private
+    def __init_spill__(memory_limit, dumper, dir)
+      @__spill_max__ = Integer(memory_limit) / ENTRY_SIZE
+      raise ArgumentError, "memory_limit is too small" if @__spill_max__ < 2
+      @__spill_dumper__ = dumper
+      @__spill_dir__    = dir
+      @__spill_runs__   = DHeap.new # scored by each run's head
+      @__spill_levels__ = []        # the runs on each merge level
+      @__spill_size__   = 0
+    end
+
+    # @return [Integer] the number of entries that are currently on disk
+    def spilled_size
+      @__spill_size__
+    end
+
+    # @return [Integer] the number of sorted runs that are currently on disk
+    def spilled_runs
+      @__spill_runs__.size
+    end
+
+    def size
+      super + @__spill_size__
+    end
+
+    def empty?
+      super && @__spill_runs__.empty?
+    end
+
+    def push(value, score = value)
+      __spill_room__
+      super
+    end
+
+    def <<(value)
+      __spill_room__
+      super
+    end
+
+    def insert(score, value)
+      __spill_room__
+      super
+    end
+
+    def peek
+      (run = __spill_min_run__) ? run.value : super
+    end
+
+    def peek_score
+      (run = __spill_min_run__) ? run.score : super
+    end
+
+    def peek_with_score
+      (run = __spill_min_run__) ? [run.value, run.score] : super
+    end
+
+    def pop
+      (run = __spill_min_run__) ? __spill_shift__(run).first : super
+    end
+
+    def pop_with_score
+      (run = __spill_min_run__) ? __spill_shift__(run) : super
+    end
+
+    def push_pop(value, score = value)
+      push(value, score)
+      pop
+    end
+
+    def replace_top(value, score = value)
+      popped = pop
+      push(value, score)
+      popped
+    end
+
+    def pop_lt(max_score)
+      return super unless (run = __spill_min_run__)
+      __spill_shift__(run).first if run.score < max_score
+    end
+
+    def pop_lte(max_score)
+      return super unless (run = __spill_min_run__)
+      __spill_shift__(run).first if run.score <= max_score
+    end
+
+    def pop_all_below(max_score, receiver = [])
+      while (run = @__spill_runs__.peek) && run.score < max_score
+        super(run.score, receiver) # everything in memory before the run's head
+        receiver << __spill_shift__(run).first
+      end
+      super(max_score, receiver)
+    end
+
+    def pop_due(receiver = [], clock: :monotonic)
+      pop_all_below(__clock_now__(clock).next_float, receiver)
+    end
+
+    def next_timeout(clock: :monotonic)
+      return super unless (run = __spill_min_run__)
+      [run.score - __clock_now__(clock), 0.0].max
+    end
+
+    alias deq        pop
+    alias shift      pop
+    alias next       pop
+    alias pop_all_lt pop_all_below
+    alias pop_below  pop_lt
+
+    alias enq        push
+
+    alias first      peek
+
+    alias length     size
+    alias count      size
+
+    def clear
+      @__spill_runs__.each_pop(&:close)
+      @__spill_levels__.clear
+      @__spill_size__ = 0
+      super
+    end
+
+    # Unlike the other methods, this reads every run in full.
+    def to_a
+      super + __spill_entries__
+    end
+
+    # (see #to_a)
+    def scores_buffer
+      super << __spill_entries__.map(&:last).pack("D*")
+    end
+
+    # (see #to_a)
+    def values
+      super + __spill_entries__.map(&:first)
+    end
+
+    # Merges the spilled runs, through #each_pop (in a single thread).
+    def drain_sorted(threads: 1) # rubocop:disable Lint/UnusedMethodArgument
+      each_pop.to_a
+    end
+
+    # The runs' scores are in their files, so they can't be transformed lazily.
+    def shift_scores!(_delta)
+      raise TypeError, "can't transform the scores of a DHeap with a memory_limit"
+    end
+
+    # (see #shift_scores!)
+    def scale_scores!(_factor)
+      raise TypeError, "can't transform the scores of a DHeap with a memory_limit"
+    end
+
+    # The runs' files can't be shared, and #dup wouldn't copy this module.
+    def dup
+      raise TypeError, "can't copy a DHeap with a memory_limit"
+    end
+
+    def initialize_copy(*)
+      raise TypeError, "can't copy a DHeap with a memory_limit"
+    end
+
+    private
+
+    # Loads through #push, so the memory_limit applies (in a single thread).
+    def __load_buffer__(scores, values, _threads)
+      scores = scores.unpack("D*") unless scores.is_a?(Array)
+      values ||= scores
+      unless scores.size == values.size
+        raise ArgumentError, "#{scores.size} scores for #{values.size} values"
+      end
+      values.zip(scores) do |value, score| push(value, score) end
+      self
+    end
+
+    # @return [Array<Array(Object, Float)>] every spilled entry, run by run
+    def __spill_entries__
+      @__spill_runs__.to_a.flat_map {|run, score|
+        [[run.value, score], *run.peek_remaining]
+      }
+    end
+
+    # Spills the largest half of the in-memory heap, if it's full.
+    def __spill_room__
+      return if __heap_size__ < @__spill_max__
+      values, scores = __spill_largest__(@__spill_max__ / 2)
+      run = Run.write(@__spill_dumper__, @__spill_dir__, values, scores)
+      @__spill_runs__.push(run, run.score)
+      @__spill_size__ += values.size
+      (@__spill_levels__[0] ||= []) << run
+      __spill_merge_levels__
+    end
+
+    # @return [Run, nil] the run with the smallest head, if it's smaller than
+    #   the in-memory minimum (ties go to the in-memory heap).
+    def __spill_min_run__
+      return unless (run = @__spill_runs__.peek)
+      min_score = __heap_peek_score__
+      run if min_score.nil? || run.score < min_score
+    end
+
+    # @return [Array(Object, Float)] the run's head, after advancing the run
+    def __spill_shift__(run)
+      entry = [run.value, run.score]
+      @__spill_runs__.pop
+      @__spill_runs__.push(run, run.score) if run.advance
+      @__spill_size__ -= 1
+      entry
+    end
+
+    # Merges any level with MERGE_WIDTH unexhausted runs into the next level,
+    # starting from level 0.
+    def __spill_merge_levels__
+      level = 0
+      while (runs = @__spill_levels__[level])
+        runs.reject!(&:closed?)
+        break if runs.size < MERGE_WIDTH
+        merged = __spill_merge_runs__(runs)
+        runs.clear
+        (@__spill_levels__[level + 1] ||= []) << merged
+        level += 1
+      end
+    end
+
+    # Merges runs into one.  Records are copied without being re-dumped, so only
+    # one value per run is held in memory.
+    #
+    # @return [Run] the merged run, which replaces the runs in the heap of runs
+    def __spill_merge_runs__(runs)
+      others = @__spill_runs__.to_a.reject {|run, _| runs.include?(run) }
+      @__spill_runs__.clear
+      others.each do |run, score| @__spill_runs__.push(run, score) end
+      heads = DHeap.new
+      count = 0
+      runs.each do |run|
+        heads.push(run, run.score)
+        count += run.remaining + 1
+      end
+      file = Run.tempfile(@__spill_dir__)
+      until heads.empty?
+        run = heads.pop
+        run.write_head_to(file)
+        heads.push(run, run.score) if run.advance
+      end
+      merged = Run.new(file, count, @__spill_dumper__)
+      @__spill_runs__.push(merged, merged.score)
+      merged
+    end
+
+  end
+
+  alias __heap_size__       size
+  alias __heap_peek_score__ peek_score
+  private :__heap_size__, :__heap_peek_score__
+
+end
@@ -0,0 +1,289 @@
+# frozen_string_literal: true
+
+class DHeap
+
+  # Records a compact binary trace of the operations performed on a heap, which
+  # can be replayed against other implementations and options by
+  # DHeap::Benchmarks::Replay.  Scores are recorded, but values are replaced by
+  # an integer id, so traces can be shared without sharing any actual data.
+  #
+  # A trace file is the MAGIC header followed by fixed size records:
+  #
+  #   op code [uint8], score [float64-le], value id [uint64-le]
+  #
+  # @see DHeap#trace_to
+  module Trace
+    MAGIC       = "DHTRACE1".b.freeze
+    RECORD      = "CEQ<"
+    RECORD_SIZE = 17
+
+    # Op codes
+    PUSH          = 1 # score, id
+    POP           = 2
+    POP_LT        = 3 # max score
+    POP_LTE       = 4 # max score
+    POP_ALL_BELOW = 5 # max score
+    PEEK          = 6
+    CLEAR         = 7
+    DELETE        = 8 # id
+
+    OPS = {
+      PUSH => :push,
+      POP => :pop,
+      POP_LT => :pop_lt,
+      POP_LTE => :pop_lte,
+      POP_ALL_BELOW => :pop_all_below,
+      PEEK => :peek,
+      CLEAR => :clear,
+      DELETE => :delete,
+    }.freeze
+
+    # Records are buffered, and flushed after this many bytes.
+    BUFFER_SIZE = RECORD_SIZE * 4096
+
+    # Extended onto a heap's singleton class by DHeap#trace_to.
+    module Recorder
+      def push(value, score = value)
+        __trace__(PUSH, score, value)
+        super
+      end
+
+      def <<(value)
+        __trace__(PUSH, value, value)
+        super
+      end
+
+      def insert(score, value)
+        __trace__(PUSH, score, value)
+        super
+      end
+
+      def pop
+        __trace__(POP)
+        super
+      end
+
+      def pop_with_score
+        __trace__(POP)
+        super
+      end
+
+      def push_pop(value, score = value)
+        __trace__(PUSH, score, value)
+        __trace__(POP)
+        super
+      end
+
+      def replace_top(value, score = value)
+        __trace__(POP)
+        __trace__(PUSH, score, value)
+        super
+      end
+
+      def pop_lt(max_score)
+        __trace__(POP_LT, max_score)
+        super
+      end
+
+      def pop_lte(max_score)
+        __trace__(POP_LTE, max_score)
+        super
+      end
+
+      def pop_all_below(max_score, *receiver)
+        __trace__(POP_ALL_BELOW, max_score)
+        super
+      end
+
+      # Recorded (and run) as the equivalent pop_all_below, so the clock is read
+      # once, and the recorded threshold is the one that was used.
+      def pop_due(receiver = [], clock: :monotonic)
+        pop_all_below(__clock_now__(clock).next_float, receiver)
+      end
+
+      # Recorded as a pop for each value.
+      def drain_sorted(threads: 1)
+        size.times do __trace__(POP) end
+        super
+      end
+
+      def peek
+        __trace__(PEEK)
+        super
+      end
+
+      def next_timeout(clock: :monotonic)
+        __trace__(PEEK)
+        super
+      end
+
+      def clear
+        __trace__(CLEAR)
+        super
+      end
+
+      alias_method :deq,        :pop
+      alias_method :shift,      :pop
+      alias_method :next,       :pop
+      alias_method :pop_all_lt, :pop_all_below
+      alias_method :pop_below,  :pop_lt
+      alias_method :enq,        :push
+      alias_method :first,      :peek
+
+      # Stops recording, flushes the trace, and closes it (when #trace_to opened
+      # it).
+      #
+      # @return [self]
+      def stop_trace
+        return self unless tracing?
+        __trace_flush__
+        @__trace_io__.close if @__trace_close__
+        %i[@__trace_io__ @__trace_close__ @__trace_ids__ @__trace_buf__]
+          .each do |ivar| remove_instance_variable(ivar) end
+        # unextending isn't possible, so the recorder methods are left to
+        # pass through to super.
+        self
+      end
+
+      # @return [Boolean] if a trace is currently being recorded
+      def tracing?
+        !!defined?(@__trace_io__)
+      end
+
+      private
+
+      def __trace__(op, score = 0.0, value = nil)
+        return unless defined?(@__trace_io__)
+        id = value.nil? ? 0 : (@__trace_ids__[value] ||= @__trace_ids__.size + 1)
+        # recorded as stored, so replays match after #shift_scores! and
+        # #scale_scores!
+        [op, __stored_score__(score), id].pack(RECORD, buffer: @__trace_buf__)
+        __trace_flush__ if BUFFER_SIZE <= @__trace_buf__.bytesize
+      end
+
+      def __trace_flush__
+        return unless defined?(@__trace_io__)
+        @__trace_io__.write(@__trace_buf__)
+        @__trace_buf__.clear
+      end
+
+    end
+
+    # Extended onto DHeap::Map, so that rescores (which are recorded as pushes
+    # of an already known id) and deletes are recorded too.
+    module MapRecorder
+      def []=(object, score)
+        __trace__(PUSH, score, object)
+        super
+      end
+
+      alias_method :rescore, :[]=
+      alias_method :update,  :[]=
+
+      def delete(object)
+        __trace__(DELETE, 0.0, object)
+        super
+      end
+
+      # Recorded as a delete for each object.
+      def delete_all(objects)
+        objects.each do |object| __trace__(DELETE, 0.0, object) end
+        super
+      end
+
+      # Recorded as a delete for each member that the block rejected, after
+      # they've all been yielded (which is when they're deleted).
+      def delete_if(&block)
+        return super unless block
+        __trace_filter__(false, block) {|filter| super(&filter) }
+      end
+
+      # (see #delete_if)
+      def reject!(&block)
+        return super unless block
+        __trace_filter__(false, block) {|filter| super(&filter) }
+      end
+
+      # (see #delete_if)
+      def keep_if(&block)
+        return super unless block
+        __trace_filter__(true, block) {|filter| super(&filter) }
+      end
+
+      # (see #delete_if)
+      def select!(&block)
+        return super unless block
+        __trace_filter__(true, block) {|filter| super(&filter) }
+      end
+
+      private
+
+      # Yields a filter that wraps block, and records the members it rejected.
+      def __trace_filter__(keep, block)
+        rejected = []
+        result = yield(proc {|value, score|
+          block.call(value, score).tap {|kept|
+            rejected << value if keep ? !kept : kept
+          }
+        })
+        rejected.each do |value| __trace__(DELETE, 0.0, value) end
+        result
+      end
+    end
+
+    # Reads a trace file into an op String and score and id Arrays, which is
+    # convenient for replaying without allocating in the replay loop.
+    #
+    # @param path [String] the trace file
+    # @return [Array(String, Array<Float>, Array<Integer>)] op codes (as bytes),
+    #   scores, and value ids
+    def self.load(path)
+      parse(File.binread(path))
+    end
+
+    # (see .load)
+    # @param data [String] the contents of a trace file
+    def self.parse(data)
+      raise ArgumentError, "not a DHeap trace" unless data.start_with?(MAGIC)
+      count = (data.bytesize - MAGIC.bytesize) / RECORD_SIZE
+      fields = data.unpack("@#{MAGIC.bytesize}#{RECORD * count}")
+      ops = fields.each_slice(3).map(&:first).pack("C*")
+      scores = Array.new(count) {|i| fields[i * 3 + 1] }
+      ids = Array.new(count) {|i| fields[i * 3 + 2] }
+      [ops, scores, ids]
+    end
+
+  end
+
+  # Starts recording a trace of this heap's operations to a file or IO.
+  #
+  # Values are mapped to small integer ids (by +#hash+ and +#eql?+), in order of
+  # first appearance.  Tracing adds a small overhead to every operation, but
+  # heaps that aren't being traced are unaffected.
+  #
+  # When a block is given, the trace is stopped after the block returns.
+  #
+  # @param target [String, IO] a path to create or an IO to write to
+  # @yieldparam heap [self]
+  # @return [self] or the block's result
+  #
+  # @see DHeap::Trace
+  # @see DHeap::Benchmarks::Replay
+  def trace_to(target)
+    raise ArgumentError, "already tracing" if respond_to?(:tracing?) && tracing?
+    extend Trace::Recorder
+    extend Trace::MapRecorder if defined?(Map) && is_a?(Map)
+    @__trace_close__ = !target.respond_to?(:write)
+    @__trace_io__ = @__trace_close__ ? File.open(target, "wb") : target
+    @__trace_io__.write(Trace::MAGIC)
+    @__trace_ids__ = {}
+    @__trace_buf__ = String.new(capacity: Trace::BUFFER_SIZE, encoding: Encoding::BINARY)
+    return self unless block_given?
+    begin
+      yield self
+    ensure
+      stop_trace
+    end
+  end
+
+end
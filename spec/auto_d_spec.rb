@@ -0,0 +1,62 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  describe "d: :auto" do
+    subject(:heap) { DHeap.new(d: :auto) }
+
+    let(:values) { Array.new(20_000) { rand(1_000_000) } }
+
+    it "starts with d=DEFAULT_D" do
+      expect(heap.d).to eq(DHeap::DEFAULT_D)
+    end
+
+    it "raises TypeError for other symbols" do
+      expect { DHeap.new(d: :fast) }.to raise_error(TypeError)
+    end
+
+    it "increases d for push-heavy workloads" do
+      values.each do |v| heap << v end
+      expect(heap.d).to be > DHeap::DEFAULT_D
+      expect(heap.size).to eq(values.size)
+    end
+
+    it "decreases d for pop-heavy workloads" do
+      values.each do |v| heap << v end
+      popped = Array.new(19_000) { heap.pop }
+      expect(heap.d).to be < DHeap::DEFAULT_D
+      expect(popped).to eq(values.sort.first(19_000))
+    end
+
+    it "keeps the heap ordered across rebuilds" do
+      popped = values.each_slice(1000).flat_map {|slice|
+        slice.each do |v| heap << v end
+        Array.new(200) { heap.pop }.tap {|mins| expect(mins).to eq(mins.sort) }
+      }
+      remaining = heap.each_pop.to_a
+      expect(remaining).to eq(remaining.sort)
+      expect((popped + remaining).sort).to eq(values.sort)
+    end
+
+    it "is copied by dup" do
+      values.each do |v| heap << v end
+      copy = heap.dup
+      expect(copy.d).to eq(heap.d)
+      expect(copy.each_pop.to_a).to eq(values.sort)
+    end
+
+    if defined?(DHeap::Map)
+      it "rebuilds DHeap::Map indexes" do
+        map = DHeap::Map.new(d: :auto)
+        values.each_with_index do |v, i| map[i] = v end
+        expect(map.d).to be > DHeap::DEFAULT_D
+        values.each_with_index do |v, i| expect(map[i]).to eq(v) end
+        values.each_with_index.first(5000).each do |v, i| map[i] = v - 500_000 end
+        scores = Array.new(10_000) { map.pop_with_score.last }
+        expect(scores).to eq(scores.sort)
+        expect(map.size).to eq(10_000)
+      end
+    end
+  end
+
+end
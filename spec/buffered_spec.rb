@@ -0,0 +1,91 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  describe "buffered: true" do
+
+    it "is disabled by default" do
+      expect(DHeap.new).not_to be_buffered
+      expect(DHeap.new(buffered: true)).to be_buffered
+    end
+
+    describe_any_size_heap "with a buffer" do
+      before do heap.buffered = true end
+
+      let(:values) { Array.new(500) { rand(1000) } }
+
+      it "pops a large burst in order (heapify)" do
+        values.each do |v| heap << v end
+        expect(heap.size).to eq(values.size)
+        expect(heap.each_pop.to_a).to eq(values.sort)
+      end
+
+      it "pops small bursts in order (sift-ups)" do
+        values.each do |v| heap << v end
+        expect(heap.pop).to eq(values.min)
+        expected = values.sort.drop(1)
+        more = [-1, 2000, 500]
+        more.each do |v| heap << v end
+        expect(heap.each_pop.to_a).to eq((expected + more).sort)
+      end
+
+      it "folds before peek, pop_lt, pop_lte, and pop_all_below" do
+        heap << 5 << 3 << 4
+        expect(heap.peek).to eq(3)
+        heap << 2
+        expect(heap.peek_score).to eq(2)
+        heap << 1
+        expect(heap.peek_with_score).to eq([1, 1])
+        heap << 0
+        expect(heap.pop_lt(1)).to eq(0)
+        heap << -1
+        expect(heap.pop_lte(-1)).to eq(-1)
+        heap << 3.5
+        expect(heap.pop_all_below(4)).to eq([1, 2, 3, 3.5])
+        expect(heap.to_a.map(&:first).sort).to eq([4, 5])
+      end
+
+      it "folds when buffering is disabled" do
+        values.each do |v| heap << v end
+        heap.buffered = false
+        expect(heap.to_a.first.first).to eq(values.min)
+        heap << -1
+        expect(heap.to_a.first.first).to eq(-1)
+      end
+
+      it "copies the buffer with dup" do
+        values.each do |v| heap << v end
+        copy = heap.dup
+        expect(copy).to be_buffered
+        expect(copy.each_pop.to_a).to eq(values.sort)
+        expect(heap.size).to eq(values.size)
+      end
+
+      it "can be cleared" do
+        values.each do |v| heap << v end
+        heap.clear
+        heap << 7
+        expect(heap.each_pop.to_a).to eq([7])
+      end
+    end
+
+    if defined?(DHeap::Map)
+      it "rescores DHeap::Map members in and out of the buffer" do
+        map = DHeap::Map.new(buffered: true)
+        100.times do |i| map[i] = i end
+        expect(map.pop).to eq(0)
+        100.upto(150) do |i| map[i] = i end
+        map[120] = -5  # in the buffer
+        map[50]  = -10 # in the heap, with a buffer
+        map[1]   = 200 # in the heap, with a buffer
+        expect(map[120]).to eq(-5)
+        expect(map.pop_with_score).to eq([50, -10])
+        expect(map.pop_with_score).to eq([120, -5])
+        expect(map.pop).to eq(2)
+        expect(map.each_pop.to_a.last).to eq(1)
+      end
+    end
+
+  end
+
+end
@@ -123,10 +123,143 @@ RSpec.describe DHeap::Map do
     end
   end
 
+  # pops everything, checking the index along the way
+  def pop_all(map)
+    popped = []
+    while (value, score = map.pop_with_score)
+      expect(map[value]).to be_nil
+      popped << [value, score]
+    end
+    popped
+  end
+
+  let(:scores) { Array.new(1000) {|i| [i, rand(10_000)] }.to_h }
+
   describe "#delete(obj)" do
-    it "can delete existing values"
-    it "returns the score if the value was in the heap"
-    it "returns nil if the value wasn't in the heap"
+    before do
+      scores.each do |value, score| heap[value] = score end
+    end
+
+    it "can delete existing values" do
+      deleted = scores.keys.sample(300)
+      deleted.each do |value| heap.delete(value) end
+      expect(heap.size).to eq(700)
+      deleted.each do |value| expect(heap[value]).to be_nil end
+      remaining = scores.reject {|value, _| deleted.include?(value) }
+      expect(pop_all(heap).map(&:last)).to eq(remaining.values.sort)
+    end
+
+    it "returns the score if the value was in the heap" do
+      expect(heap.delete(7)).to eq(scores[7])
+      expect(heap[7]).to be_nil
+    end
+
+    it "returns nil if the value wasn't in the heap" do
+      expect(heap.delete(:missing)).to be_nil
+      expect(heap.delete(7)).not_to be_nil
+      expect(heap.delete(7)).to be_nil
+      expect(heap.size).to eq(999)
+    end
+
+    it "deletes the minimum and the last entry" do
+      min = heap.peek
+      expect(heap.delete(min)).to eq(scores[min])
+      expect(heap.peek_score).to eq(scores.values.sort[1])
+      last = heap.values.last
+      heap.delete(last)
+      expect(heap.values).not_to include(last)
+    end
+
+    it "deletes buffered pushes" do
+      heap.buffered = true
+      heap[:a] = -1
+      heap[:b] = -2
+      expect(heap.delete(:a)).to eq(-1)
+      expect(heap.delete(0)).to eq(scores[0])
+      expect(heap.pop_with_score).to eq([:b, -2])
+      expect(heap[:a]).to be_nil
+    end
+
+    it "raises FrozenError for frozen heaps" do
+      heap.freeze
+      expect { heap.delete(7) }.to raise_error(FrozenError)
+    end
+  end
+
+  describe "#delete_all(objs), #delete_if, #reject!, #keep_if, #select!" do
+    before do
+      scores.each do |value, score| heap[value] = score end
+    end
+
+    def expect_members(map, expected)
+      expect(map.size).to eq(expected.size)
+      expected.each do |value, score| expect(map[value]).to eq(score) end
+      expect(pop_all(map).map(&:last)).to eq(expected.values.sort)
+    end
+
+    it "deletes many members with #delete_all" do
+      deleted = scores.keys.sample(600) + [:missing]
+      expect(heap.delete_all(deleted)).to eq(600)
+      expect_members(heap, scores.reject {|value, _| deleted.include?(value) })
+    end
+
+    it "deletes a few members with #delete_all" do
+      expect(heap.delete_all([1, 2, 3, 3])).to eq(3)
+      expect_members(heap, scores.reject {|value, _| value.between?(1, 3) })
+    end
+
+    it "leaves the heap intact when an object's #hash raises" do
+      bad = Object.new
+      def bad.hash; raise ArgumentError, "no hash" end
+      expect { heap.delete_all(scores.keys.first(600) + [bad]) }
+        .to raise_error(ArgumentError, "no hash")
+      expect { heap.delete_all([1, bad]) }.to raise_error(ArgumentError)
+      expect_members(heap, scores.reject {|value, _| value == 1 })
+    end
+
+    it "deletes with #delete_if" do
+      expect(heap.delete_if {|_, score| score < 5000 }).to equal(heap)
+      expect_members(heap, scores.reject {|_, score| score < 5000 })
+    end
+
+    it "returns nil from #reject! and #select! when nothing is deleted" do
+      expect(heap.reject! {|_, score| score < 0 }).to be_nil
+      expect(heap.select! {|_, score| score >= 0 }).to be_nil
+      expect(heap.reject! {|value, _| value.odd? }).to equal(heap)
+      expect(heap.select! {|value, _| value < 500 }).to equal(heap)
+      expect_members(heap, scores.select {|value, _| value.even? && value < 500 })
+    end
+
+    it "deletes with #keep_if" do
+      expect(heap.keep_if {|value, _| value % 3 == 0 }).to equal(heap)
+      expect_members(heap, scores.select {|value, _| value % 3 == 0 })
+    end
+
+    it "yields transformed scores" do
+      heap.shift_scores!(0.5)
+      yielded = []
+      heap.delete_if {|value, score| yielded << [value, score] && false }
+      expect(yielded.sort).to eq(scores.map {|value, score| [value, score + 0.5] }.sort)
+    end
+
+    it "returns a sized Enumerator without a block" do
+      expect(heap.delete_if.size).to eq(1000)
+      expect(heap.reject!.each {|_, score| score < 5000 }).to equal(heap)
+      expect_members(heap, scores.reject {|_, score| score < 5000 })
+    end
+
+    it "works with buffered pushes and the paged layout" do
+      map = DHeap::Map.new(buffered: true, layout: :paged, d: 4)
+      scores.each do |value, score| map[value] = score end
+      map.delete_if {|value, _| value.odd? }
+      expect_members(map, scores.reject {|value, _| value.odd? })
+    end
+
+    it "raises FrozenError for frozen heaps" do
+      heap.freeze
+      expect { heap.delete_all([1]) }.to raise_error(FrozenError)
+      expect { heap.delete_if { true } }.to raise_error(FrozenError)
+    end
   end
 
 end
@@ -0,0 +1,102 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap, ".dijkstra" do
+
+  # returns [offsets, targets, weights]
+  def random_graph(nodes, edges)
+    adjacency = Array.new(nodes) { [] }
+    edges.times do adjacency[rand(nodes)] << [rand(nodes), rand(100).to_f] end
+    offsets = adjacency.each_with_object([0]) {|adj, offs| offs << offs.last + adj.size }
+    [offsets, adjacency.flatten(1).map(&:first), adjacency.flatten(1).map(&:last)]
+  end
+
+  # a naive O(n²) reference implementation
+  def reference_dists(offsets, targets, weights, source)
+    dist = Array.new(offsets.size - 1, Float::INFINITY)
+    dist[source] = 0.0
+    done = {}
+    until (u = (0...dist.size).reject {|i| done[i] }.min_by {|i| dist[i] }).nil?
+      break if dist[u].infinite?
+      done[u] = true
+      (offsets[u]...offsets[u + 1]).each do |e|
+        alt = dist[u] + weights[e]
+        dist[targets[e]] = alt if alt < dist[targets[e]]
+      end
+    end
+    dist
+  end
+
+  let(:graph) { [[0, 2, 3, 3, 3], [1, 2, 2], [1.0, 5.0, 2.0]] }
+
+  it "returns distances and predecessors" do
+    dist, pred = DHeap.dijkstra(*graph, 0)
+    expect(dist).to eq([0.0, 1.0, 3.0, Float::INFINITY])
+    expect(pred).to eq([nil, 0, 1, nil])
+  end
+
+  it "accepts packed Strings" do
+    offsets, targets, weights = graph
+    dist, pred = DHeap.dijkstra(
+      offsets.pack("Q*"), targets.pack("Q*"), weights.pack("D*"), 1
+    )
+    expect(dist).to eq([Float::INFINITY, 0.0, 2.0, Float::INFINITY])
+    expect(pred).to eq([nil, nil, 1, nil])
+  end
+
+  it "can stop once the target's distance is known" do
+    dist, = DHeap.dijkstra(*graph, 0, target: 1)
+    expect(dist[1]).to eq(1.0)
+  end
+
+  [2, 3, 4, 8, 16].each do |d|
+    it "matches a reference implementation with d=#{d}" do
+      offsets, targets, weights = random_graph(300, 2000)
+      dist, pred = DHeap.dijkstra(offsets, targets, weights, 0, d: d)
+      expect(dist).to eq(reference_dists(offsets, targets, weights, 0))
+      pred.each_with_index do |u, v|
+        next unless u
+        edge = (offsets[u]...offsets[u + 1]).find {|e|
+          targets[e] == v && dist[u] + weights[e] == dist[v]
+        }
+        expect(edge).not_to be_nil
+      end
+    end
+  end
+
+  it "finds the same target distance with or without target:" do
+    offsets, targets, weights = random_graph(1000, 5000)
+    all, = DHeap.dijkstra(offsets, targets, weights, 0)
+    dist, = DHeap.dijkstra(offsets, targets, weights, 0, target: 999)
+    expect(dist[999]).to eq(all[999])
+  end
+
+  it "raises for invalid graphs" do
+    offsets, targets, weights = graph
+    expect { DHeap.dijkstra([], [], [], 0) }.to raise_error(ArgumentError)
+    expect { DHeap.dijkstra(offsets, targets, weights, 4) }
+      .to raise_error(IndexError)
+    expect { DHeap.dijkstra(offsets, targets, weights, 0, target: 9) }
+      .to raise_error(IndexError)
+    expect { DHeap.dijkstra(offsets, [1, 2, 7], weights, 0) }
+      .to raise_error(IndexError)
+    expect { DHeap.dijkstra(offsets, targets, [1, -5, 2], 0) }
+      .to raise_error(ArgumentError)
+    expect { DHeap.dijkstra([0, 2, 1, 3, 3], targets, weights, 0) }
+      .to raise_error(ArgumentError)
+    expect { DHeap.dijkstra(offsets, targets, [1.0], 0) }
+      .to raise_error(ArgumentError)
+    expect { DHeap.dijkstra(offsets, "abc", weights, 0) }
+      .to raise_error(ArgumentError)
+    expect { DHeap.dijkstra(*graph, 0, d: 1) }.to raise_error(ArgumentError)
+  end
+
+  it "unlocks packed Strings" do
+    offsets, targets, weights = graph
+    packed = targets.pack("Q*")
+    DHeap.dijkstra(offsets, packed, weights, 0)
+    expect { DHeap.dijkstra(offsets, packed, [1, -1, 1], 0) }
+      .to raise_error(ArgumentError)
+    expect { packed << "x" }.not_to raise_error
+  end
+
+end
@@ -31,6 +31,79 @@ RSpec.describe DHeap do
     include_examples "unfrozen copy", -> orig { orig.dup }, freeze_orig: true
   end
 
+  describe "copy-on-write" do
+    let(:values) { Array.new(1000) { rand(10_000) } }
+    let(:orig) { DHeap.new.tap {|heap| values.each do |v| heap << v end } }
+
+    it "keeps copies independent after either is modified" do
+      copy = orig.dup
+      orig << -1
+      expect(copy.peek).to eq(values.min)
+      copy << -2
+      expect(orig.peek).to eq(-1)
+      expect(orig.each_pop.to_a).to eq([-1] + values.sort)
+      expect(copy.each_pop.to_a).to eq([-2] + values.sort)
+    end
+
+    it "shares between many copies, including copies of copies" do
+      copies = Array.new(3) { orig.dup }
+      copies << copies.last.dup
+      copies.each_with_index do |copy, i|
+        copy.pop
+        copy << -i
+      end
+      expect(orig.each_pop.to_a).to eq(values.sort)
+      copies.each_with_index do |copy, i|
+        expect(copy.each_pop.to_a).to eq([-i] + values.sort.drop(1))
+      end
+    end
+
+    it "survives the original being garbage collected" do
+      copy = DHeap.new.tap {|heap| values.each do |v| heap << v end }.dup
+      GC.start
+      expect(copy.each_pop.to_a).to eq(values.sort)
+    end
+
+    it "clears without modifying the other heap" do
+      copy = orig.dup
+      copy.clear
+      expect(copy).to be_empty
+      copy << 5
+      expect(copy.to_a).to eq([[5, 5.0]])
+      expect(orig.size).to eq(values.size)
+      orig.clear
+      expect(orig).to be_empty
+    end
+
+    it "folds buffered pushes without modifying the other heap" do
+      orig.buffered = true
+      orig << -1
+      copy = orig.dup
+      expect(copy.peek).to eq(-1)
+      expect(orig.to_a.size).to eq(values.size + 1)
+      expect(orig.each_pop.to_a).to eq([-1] + values.sort)
+      expect(copy.each_pop.to_a).to eq([-1] + values.sort)
+    end
+
+    if defined?(DHeap::Map)
+      it "keeps DHeap::Map indexes independent" do
+        map = DHeap::Map.new
+        values.each_with_index do |v, i| map[i] = v end
+        copy = map.dup
+        copy[0] = -1
+        copy.pop
+        expect(map[0]).to eq(values[0])
+        expect(copy[0]).to be_nil
+        map[1] = -1
+        expect(copy[1]).to eq(values[1])
+        expect(map.pop).to eq(1)
+        copy.clear
+        expect(map.size).to eq(values.size - 1)
+        expect(map[2]).to eq(values[2])
+      end
+    end
+  end
+
   shared_examples "frozen copy" do |copier, freeze_orig: true|
     it "creates a frozen copy" do
       orig = DHeap.new
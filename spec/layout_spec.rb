@@ -0,0 +1,77 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  describe "layout: :paged" do
+    let(:values) { Array.new(20_000) { rand(1_000_000) } }
+
+    it "defaults to :flat" do
+      expect(DHeap.new.layout).to eq(:flat)
+      expect(DHeap.new(layout: :paged).layout).to eq(:paged)
+    end
+
+    it "raises ArgumentError for unknown layouts" do
+      expect { DHeap.new(layout: :vEB) }.to raise_error(ArgumentError)
+      expect { DHeap.new(layout: "paged") }.to raise_error(ArgumentError)
+    end
+
+    [2, 3, 4, 6, 16, 300].each do |d|
+      context "with d=#{d}" do
+        subject(:heap) { DHeap.new(d: d, layout: :paged) }
+
+        it "pops everything in order" do
+          values.each do |v| heap << v end
+          expect(heap.size).to eq(values.size)
+          expect(heap.to_a.map(&:last).sort).to eq(values.sort)
+          expect(heap.each_pop.to_a).to eq(values.sort)
+        end
+
+        it "interleaves pushes and pops" do
+          popped = values.each_slice(100).flat_map {|slice|
+            slice.each do |v| heap << v end
+            Array.new(30) { heap.pop }.tap {|mins| expect(mins).to eq(mins.sort) }
+          }
+          remaining = heap.each_pop.to_a
+          expect(remaining).to eq(remaining.sort)
+          expect((popped + remaining).sort).to eq(values.sort)
+        end
+
+        it "heapifies a buffered burst" do
+          heap.buffered = true
+          values.each do |v| heap << v end
+          expect(heap.each_pop.to_a).to eq(values.sort)
+        end
+
+        it "is copied by dup" do
+          values.first(1000).each do |v| heap << v end
+          copy = heap.dup
+          expect(copy.layout).to eq(:paged)
+          expect(copy.each_pop.to_a).to eq(values.first(1000).sort)
+        end
+      end
+    end
+
+    it "rebuilds the pages when d: :auto changes d" do
+      heap = DHeap.new(d: :auto, layout: :paged)
+      values.each do |v| heap << v end
+      expect(heap.d).not_to eq(DHeap::DEFAULT_D)
+      expect(heap.each_pop.to_a).to eq(values.sort)
+    end
+
+    if defined?(DHeap::Map)
+      it "keeps DHeap::Map indexes" do
+        map = DHeap::Map.new(d: 4, layout: :paged)
+        values.each_with_index do |v, i| map[i] = v end
+        values.each_with_index.first(5000).each do |v, i| map[i] = v - 500_000 end
+        values.each_with_index.first(5000).each do |v, i|
+          expect(map[i]).to eq(v - 500_000)
+        end
+        scores = Array.new(10_000) { map.pop_with_score.last }
+        expect(scores).to eq(scores.sort)
+        expect(map.size).to eq(10_000)
+      end
+    end
+
+  end
+
+end
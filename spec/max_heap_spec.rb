@@ -0,0 +1,72 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap::Max do
+  subject(:heap) { DHeap::Max.new }
+
+  let(:values) { Array.new(1000) { rand(10_000) } }
+
+  it "is a DHeap" do
+    expect(heap).to be_a(DHeap)
+    expect(DHeap::Max.new(d: 3).d).to eq(3)
+  end
+
+  it "pops the largest scores first" do
+    values.each do |v| heap << v end
+    expect(heap.peek).to eq(values.max)
+    expect(heap.each_pop.to_a).to eq(values.sort.reverse)
+  end
+
+  it "returns scores without negation" do
+    heap.push(:a, 1)
+    heap.insert(3, :c)
+    heap.push(:b, 2.5)
+    expect(heap.peek_score).to eq(3.0)
+    expect(heap.peek_with_score).to eq([:c, 3.0])
+    expect(heap.to_a.map(&:last).sort).to eq([1.0, 2.5, 3.0])
+    expect(heap.scores_buffer.unpack("D*").sort).to eq([1.0, 2.5, 3.0])
+    expect(heap.pop_with_score).to eq([:c, 3.0])
+    expect(heap.each_pop(with_scores: true).to_a).to eq([[:b, 2.5], [:a, 1.0]])
+    expect(heap.pop_with_score).to be_nil
+    expect(heap.peek_score).to be_nil
+  end
+
+  it "pops conditionally with pop_gt, pop_gte, and pop_all_above" do
+    [1, 5, 7, 9].each do |v| heap << v end
+    expect(heap.pop_gt(9)).to be_nil
+    expect(heap.pop_gte(9)).to eq(9)
+    expect(heap.pop_above(7)).to eq(nil)
+    expect(heap.pop_all_above(1)).to eq([7, 5])
+    receiver = [:pre]
+    expect(heap.pop_all_gt(0, receiver)).to equal(receiver)
+    expect(receiver).to eq([:pre, 1])
+  end
+
+  it "doesn't respond to the min-heap's conditional pops" do
+    %i[pop_lt pop_lte pop_all_below pop_all_lt pop_below pop_due next_timeout]
+      .each do |name| expect(heap).not_to respond_to(name) end
+    expect(DHeap.new).to respond_to(:pop_lt)
+  end
+
+  it "supports push_pop and replace_top" do
+    heap << 5 << 7
+    expect(heap.push_pop(:a, 9)).to eq(:a)
+    expect(heap.push_pop(:b, 6)).to eq(7)
+    expect(heap.replace_top(:c, 1)).to eq(:b)
+    expect(heap.each_pop.to_a).to eq([5, :c])
+  end
+
+  it "supports buffered pushes, layouts, dup, and from_buffer" do
+    heap = DHeap::Max.new(buffered: true, layout: :paged, d: :auto)
+    values.each do |v| heap << v end
+    copy = heap.dup
+    expect(copy).to be_a(DHeap::Max)
+    expect(copy.each_pop.to_a).to eq(values.sort.reverse)
+    loaded = DHeap::Max.from_buffer(heap.scores_buffer, heap.values)
+    expect(loaded).to be_a(DHeap::Max)
+    expect(loaded.each_pop.to_a).to eq(values.sort.reverse)
+  end
+
+  it "rejects memory_limit" do
+    expect { DHeap::Max.new(memory_limit: 1024) }.to raise_error(ArgumentError)
+  end
+end
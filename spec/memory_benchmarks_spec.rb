@@ -0,0 +1,51 @@
+# frozen_string_literal: true
+
+require "d_heap/benchmarks/memory"
+require "tmpdir"
+
+RSpec.describe DHeap::Benchmarks::Memory do
+
+  let(:implementations) {
+    DHeap::Benchmarks::IMPLEMENTATIONS.select {|impl|
+      [DHeap::Benchmarks::RbHeap, DHeap].include?(impl.klass)
+    }
+  }
+
+  def memory(**options)
+    described_class.new(implementations: implementations,
+                        n_vals: [10, 1000],
+                        iterations: 1000,
+                        repeat_count: 1,
+                        io: StringIO.new,
+                        **options)
+  end
+
+  it "measures allocations, GC time, and peak RSS per op" do
+    results = memory(scenarios: %w[push_pop pop_with_score]).call
+    push_pop = results.fetch("push_pop")
+    expect(push_pop.keys).to eq(["ruby binary heap", "quaternary DHeap"])
+    measurement = push_pop.fetch("quaternary DHeap").fetch("N 1000").first
+    expect(measurement.fetch("allocations")).to be < 0.1
+    expect(measurement.fetch("gc_time")).to be >= 0
+    # pop_with_score allocates an Array for every pop
+    measurement = results.fetch("pop_with_score").fetch("DHeap").fetch("N 1000").first
+    expect(measurement.fetch("allocations")).to be >= 0.5
+  end
+
+  it "measures the memsize of N-item queues" do
+    memsize = memory(scenarios: %w[memsize]).call.fetch("memsize")
+    sizes = memsize.fetch("quaternary DHeap")
+    expect(sizes.fetch("N 1000").first.fetch("memsize"))
+      .to be > sizes.fetch("N 10").first.fetch("memsize")
+  end
+
+  it "writes results.yml files for bin/benchmark-driver" do
+    Dir.mktmpdir do |dir|
+      memory(output_dir: dir, scenarios: %w[push_n memsize]).call
+      files = Dir.chdir(dir) { Dir.glob("*/*.yml") }
+      expect(files).to include("memory_push_n/results.yml", "memory_push_n/gc_time.yml")
+      expect(files.grep(/memsize/)).to eq(["memory_memsize/results.yml"])
+    end
+  end
+
+end
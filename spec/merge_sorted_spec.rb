@@ -0,0 +1,66 @@
+# frozen_string_literal: true
+
+require "set"
+
+RSpec.describe DHeap do
+
+  describe ".merge_sorted" do
+
+    it "merges sorted Arrays" do
+      expect(DHeap.merge_sorted([[1, 4, 9], [2, 3], [5]])).to eq([1, 2, 3, 4, 5, 9])
+    end
+
+    it "handles no sources, one source, and empty sources" do
+      expect(DHeap.merge_sorted([])).to eq([])
+      expect(DHeap.merge_sorted([[3, 5]])).to eq([3, 5])
+      expect(DHeap.merge_sorted([[], [1], []])).to eq([1])
+    end
+
+    it "merges many sources of different sizes" do
+      [2, 3, 7, 64, 100, 257].each do |k|
+        sources = Array.new(k) { Array.new(rand(20)) { rand(1000) }.sort }
+        expect(DHeap.merge_sorted(sources)).to eq(sources.flatten.sort)
+      end
+    end
+
+    it "merges equal scores stably, in source order" do
+      sources = [[[1, :a], [2, :a]], [[1, :b]], [[0, :c], [2, :c]]]
+      expect(DHeap.merge_sorted(sources, by: :first).map(&:last))
+        .to eq(%i[c a b a c])
+    end
+
+    it "scores elements with by:" do
+      sources = [%w[a ccc], %w[bb dddd]]
+      expect(DHeap.merge_sorted(sources, by: :size)).to eq(%w[a bb ccc dddd])
+      expect(DHeap.merge_sorted(sources, by: ->(s) { s.size }))
+        .to eq(%w[a bb ccc dddd])
+    end
+
+    it "reads Enumerators and other Enumerables" do
+      sources = [[1, 5].each, (2..4), Set[0, 6]]
+      expect(DHeap.merge_sorted(sources)).to eq([0, 1, 2, 3, 4, 5, 6])
+    end
+
+    it "yields batches" do
+      batches = []
+      result = DHeap.merge_sorted([[1, 3, 5], [2, 4]], batch_size: 2) do |batch|
+        batches << batch
+      end
+      expect(result).to be_nil
+      expect(batches).to eq([[1, 2], [3, 4], [5]])
+    end
+
+    it "raises for a non-positive batch_size" do
+      expect { DHeap.merge_sorted([[1]], batch_size: 0) {} }
+        .to raise_error(ArgumentError)
+    end
+
+    it "converts scores like push" do
+      expect(DHeap.merge_sorted([[Time.at(2)], [Time.at(1)]]))
+        .to eq([Time.at(1), Time.at(2)])
+      expect { DHeap.merge_sorted([[:a]]) }.to raise_error(TypeError)
+    end
+
+  end
+
+end
@@ -0,0 +1,116 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  # large enough to be split between threads
+  let(:scores) { Array.new(100_000) { rand(1_000_000) / 10.0 } }
+  let(:values) { Array.new(scores.size) {|i| i } }
+
+  describe ".from_buffer(scores, values, threads:)" do
+    [1, 2, 3, 8].each do |threads|
+      [2, 4, 7].each do |d|
+        it "heapifies with threads=#{threads} and d=#{d}" do
+          heap = DHeap.from_buffer(scores.pack("D*"), values, threads: threads, d: d)
+          expect(heap.size).to eq(scores.size)
+          expect(heap.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+        end
+      end
+    end
+
+    it "heapifies the paged layout" do
+      heap = DHeap.from_buffer(scores, threads: 4, layout: :paged)
+      expect(heap.each_pop.to_a).to eq(scores.sort)
+    end
+
+    it "heapifies a DHeap::Max" do
+      heap = DHeap::Max.from_buffer(scores, threads: 4)
+      expect(heap.each_pop.to_a).to eq(scores.sort.reverse)
+    end
+
+    it "heapifies buffered heaps" do
+      heap = DHeap.from_buffer(scores, threads: 4, buffered: true)
+      expect(heap.each_pop.first(100)).to eq(scores.sort.first(100))
+    end
+  end
+
+  describe "#drain_sorted(threads: 1)" do
+    [1, 2, 3, 8].each do |threads|
+      it "returns every value in pop order with threads=#{threads}" do
+        heap = DHeap.from_buffer(scores, values)
+        sorted = heap.drain_sorted(threads: threads)
+        expect(heap).to be_empty
+        expect(sorted.size).to eq(values.size)
+        expect(sorted.map {|i| scores[i] }).to eq(scores.sort)
+      end
+    end
+
+    it "returns an empty Array for an empty heap" do
+      expect(DHeap.new.drain_sorted).to eq([])
+    end
+
+    it "sorts small heaps, and buffered pushes" do
+      heap = DHeap.new
+      heap.buffered = true
+      [5, 3, 1, 4, 2].each do |i| heap << i end
+      expect(heap.drain_sorted(threads: 4)).to eq([1, 2, 3, 4, 5])
+    end
+
+    it "doesn't affect copies" do
+      heap = DHeap.from_buffer(scores)
+      copy = heap.dup
+      expect(heap.drain_sorted(threads: 2)).to eq(scores.sort)
+      expect(copy.size).to eq(scores.size)
+      expect(copy.each_pop.to_a).to eq(scores.sort)
+    end
+
+    it "keeps values that are pushed by other threads while it sorts" do
+      heap = DHeap.from_buffer(scores * 10)
+      drained = nil
+      drainer = Thread.new { drained = heap.drain_sorted(threads: 2) }
+      pushed = 0
+      while drainer.alive?
+        heap << -1
+        pushed += 1
+        Thread.pass
+      end
+      drainer.join
+      expect(drained.size + heap.size).to eq(scores.size * 10 + pushed)
+      expect(drained.reject {|score| score == -1 }).to eq((scores * 10).sort)
+      remaining = heap.size
+      expect(heap.each_pop.to_a).to eq([-1] * remaining)
+    end
+
+    it "drains a DHeap::Max in descending order" do
+      heap = DHeap::Max.from_buffer(scores)
+      expect(heap.drain_sorted(threads: 4)).to eq(scores.sort.reverse)
+    end
+
+    if defined?(DHeap::Map)
+      it "drains a DHeap::Map, removing its members" do
+        map = DHeap::Map.new
+        values.first(10_000).each do |v| map[v] = scores[v] end
+        sorted = map.drain_sorted(threads: 2)
+        expect(sorted.map {|i| scores[i] }).to eq(scores.first(10_000).sort)
+        expect(map[sorted.first]).to be_nil
+        map[sorted.first] = 1
+        expect(map.size).to eq(1)
+      end
+    end
+
+    it "merges spilled runs" do
+      heap = DHeap.from_buffer(scores.first(5000), memory_limit: 1024)
+      expect(heap.spilled_size).to be > 0
+      expect(heap.drain_sorted(threads: 2)).to eq(scores.first(5000).sort)
+      expect(heap).to be_empty
+    end
+
+    it "raises ArgumentError for fewer than one thread" do
+      expect { DHeap.new.drain_sorted(threads: 0) }.to raise_error(ArgumentError)
+    end
+
+    it "raises FrozenError for frozen heaps" do
+      expect { DHeap.new.freeze.drain_sorted }.to raise_error(FrozenError)
+    end
+  end
+
+end
@@ -58,6 +58,18 @@ RSpec.describe DHeap do
       expect(array).to have_received(:<<).with(values[4]).ordered
     end
 
+    it "pops false and nil values" do
+      heap.push false, scores[0] - 2
+      heap.push nil, scores[0] - 1
+      expect(heap.pop_all_below(scores[1])).to eq([false, nil, values[0]])
+      heap.push false, scores[0]
+      popped = []
+      receiver = Object.new
+      receiver.define_singleton_method(:<<) do |value| popped << value end
+      heap.pop_all_below(scores[2], receiver)
+      expect(popped).to eq([false, values[1]])
+    end
+
     it "raises NoMethodError if object doesn't respond to <<" do
       object = Object.new
       expect{ heap.pop_all_below(scores[3], object) }
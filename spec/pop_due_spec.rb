@@ -0,0 +1,99 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  let(:now) { Process.clock_gettime(Process::CLOCK_MONOTONIC) }
+
+  describe "#pop_due(receiver = [], clock: :monotonic)" do
+    subject(:heap) { DHeap.new }
+
+    it "pops every value that is due, in order" do
+      heap.push(:later, now + 60)
+      heap.push(:b, now - 1)
+      heap.push(:a, now - 2)
+      heap.push(:c, now)
+      expect(heap.pop_due).to eq(%i[a b c])
+      expect(heap.pop_due).to eq([])
+      expect(heap.size).to eq(1)
+    end
+
+    it "pushes values into the receiver" do
+      heap.push(:a, now - 1)
+      receiver = [:pre]
+      expect(heap.pop_due(receiver)).to equal(receiver)
+      expect(receiver).to eq(%i[pre a])
+    end
+
+    it "pops false and nil values" do
+      heap.push(nil, now - 2)
+      heap.push(false, now - 1)
+      expect(heap.pop_due).to eq([nil, false])
+    end
+
+    it "reads other clocks" do
+      heap.push(:past, Time.now - 1)
+      heap.push(:future, Time.now + 60)
+      expect(heap.pop_due).to eq([]) # epoch seconds are far in the future
+      expect(heap.pop_due(clock: :realtime)).to eq(%i[past])
+      heap.pop
+      heap.push(:past, now - 1)
+      expect(heap.pop_due(clock: Process::CLOCK_MONOTONIC)).to eq(%i[past])
+    end
+
+    it "raises ArgumentError for unknown clocks" do
+      expect { heap.pop_due(clock: :sundial) }.to raise_error(ArgumentError)
+      expect { heap.pop_due(clock: "monotonic") }.to raise_error(ArgumentError)
+    end
+
+    it "folds buffered pushes" do
+      heap.buffered = true
+      heap.push(:later, now + 60)
+      heap.push(:b, now - 1)
+      heap.push(:a, now - 2)
+      expect(heap.pop_due).to eq(%i[a b])
+    end
+
+    if defined?(DHeap::Map)
+      it "removes DHeap::Map members" do
+        map = DHeap::Map.new
+        map[:a] = now - 1
+        map[:b] = now + 60
+        expect(map.pop_due).to eq([:a])
+        expect(map[:a]).to be_nil
+        map[:a] = now - 1
+        expect(map.size).to eq(2)
+      end
+    end
+
+    it "merges spilled runs" do
+      heap = DHeap.new(memory_limit: 64 * DHeap::Spill::ENTRY_SIZE)
+      values = Array.new(500) {|i| i }.shuffle
+      values.each do |i| heap.push(i, now - 1000 + i) end
+      heap.push(:later, now + 60)
+      expect(heap.spilled_size).to be > 0
+      expect(heap.pop_due).to eq(values.sort)
+      expect(heap.next_timeout).to be_within(1).of(60)
+    end
+  end
+
+  describe "#next_timeout(clock: :monotonic)" do
+    subject(:heap) { DHeap.new }
+
+    it "returns nil when the heap is empty" do
+      expect(heap.next_timeout).to be_nil
+    end
+
+    it "returns the seconds until the minimum score" do
+      heap.push(:a, now + 30)
+      heap.push(:b, now + 60)
+      expect(heap.next_timeout).to be_within(1).of(30)
+      expect(heap.next_timeout(clock: :realtime)).to eq(0.0)
+    end
+
+    it "returns zero when the minimum is overdue" do
+      heap.push(:a, now - 30)
+      expect(heap.next_timeout).to eq(0.0)
+    end
+  end
+
+end
@@ -0,0 +1,102 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  let(:values) { Array.new(1000) { rand(10_000) } }
+
+  describe "#push_pop(value, score = value)" do
+    subject(:heap) { DHeap.new }
+
+    it "returns the pushed value when it's the new minimum" do
+      heap << 5 << 7
+      expect(heap.push_pop(:a, 3)).to eq(:a)
+      expect(heap.push_pop(:b, 5)).to eq(:b) # ties return the pushed value
+      expect(heap.to_a.map(&:first).sort).to eq([5, 7])
+    end
+
+    it "pops the minimum and keeps the pushed value" do
+      heap << 5 << 7
+      expect(heap.push_pop(:a, 6)).to eq(5)
+      expect(heap.each_pop(with_scores: true).to_a).to eq([[:a, 6.0], [7, 7.0]])
+    end
+
+    it "returns the pushed value for an empty heap" do
+      expect(heap.push_pop(3)).to eq(3)
+      expect(heap).to be_empty
+    end
+
+    it "behaves like push then pop" do
+      expected = DHeap.new
+      values.first(100).each do |v| heap << v; expected << v end
+      values.drop(100).each do |v|
+        expect(heap.push_pop(v)).to eq(expected.push(v).pop)
+      end
+      expect(heap.each_pop.to_a).to eq(expected.each_pop.to_a)
+    end
+
+    it "folds buffered pushes" do
+      heap.buffered = true
+      heap << 5 << 1
+      expect(heap.push_pop(3)).to eq(1)
+    end
+  end
+
+  describe "#replace_top(value, score = value)" do
+    subject(:heap) { DHeap.new }
+
+    it "pops the minimum and pushes the value, even if it's smaller" do
+      heap << 5 << 7
+      expect(heap.replace_top(:a, 3)).to eq(5)
+      expect(heap.each_pop(with_scores: true).to_a).to eq([[:a, 3.0], [7, 7.0]])
+    end
+
+    it "returns nil and pushes the value for an empty heap" do
+      expect(heap.replace_top(3)).to be_nil
+      expect(heap.to_a).to eq([[3, 3.0]])
+    end
+
+    it "behaves like pop then push" do
+      expected = DHeap.new
+      values.first(100).each do |v| heap << v; expected << v end
+      values.drop(100).each do |v|
+        expect(heap.replace_top(v)).to eq(expected.pop.tap { expected << v })
+      end
+      expect(heap.each_pop.to_a).to eq(expected.each_pop.to_a)
+    end
+  end
+
+  if defined?(DHeap::Map)
+    describe "DHeap::Map#push_pop and #replace_top" do
+      subject(:map) { DHeap::Map.new }
+
+      before do
+        map[:a] = 1
+        map[:b] = 2
+        map[:c] = 3
+      end
+
+      it "keeps the indexes for new members" do
+        expect(map.push_pop(:d, 0)).to eq(:d)
+        expect(map[:d]).to be_nil
+        expect(map.push_pop(:d, 2.5)).to eq(:a)
+        expect(map[:a]).to be_nil
+        expect(map[:d]).to eq(2.5)
+        expect(map.replace_top(:e, 0)).to eq(:b)
+        expect(map[:b]).to be_nil
+        expect(map[:e]).to eq(0.0)
+        expect(map.each_pop.to_a).to eq(%i[e d c])
+      end
+
+      it "rescores existing members" do
+        expect(map.push_pop(:c, 0)).to eq(:c)
+        expect(map.size).to eq(2)
+        expect(map.replace_top(:b, 0)).to eq(:a)
+        expect(map[:b]).to eq(0.0)
+        expect(map.replace_top(:b, 5)).to eq(:b)
+        expect(map[:b]).to eq(5.0)
+        expect(map.size).to eq(1)
+      end
+    end
+  end
+
+end
@@ -0,0 +1,155 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  let(:scores) { Array.new(1000) { rand(100_000) } }
+
+  describe "#shift_scores!(delta) and #scale_scores!(factor)" do
+    subject(:heap) { DHeap.new }
+
+    before do
+      scores.each do |score| heap << score end
+    end
+
+    it "adds delta to every score" do
+      expect(heap.shift_scores!(-500)).to equal(heap)
+      expect(heap.peek_score).to eq(scores.min - 500)
+      expect(heap.to_a.map(&:last).sort).to eq(scores.map {|s| s - 500.0 }.sort)
+      expect(heap.each_pop(with_scores: true).to_a.map(&:last))
+        .to eq(scores.sort.map {|s| s - 500.0 })
+    end
+
+    it "multiplies every score by factor" do
+      expect(heap.scale_scores!(0.5)).to equal(heap)
+      expect(heap.peek_with_score).to eq([scores.min, scores.min * 0.5])
+      expect(heap.scores_buffer.unpack("D*").sort).to eq(scores.map {|s| s * 0.5 }.sort)
+      expect(heap.each_pop.to_a).to eq(scores.sort)
+    end
+
+    it "composes transforms" do
+      heap.shift_scores!(10).scale_scores!(2).shift_scores!(-1)
+      expect(heap.pop_with_score).to eq([scores.min, (scores.min + 10) * 2 - 1.0])
+    end
+
+    it "doesn't transform scores that are pushed afterwards" do
+      heap.shift_scores!(-1_000_000)
+      heap.push(:after, -999_000.5)
+      expect(heap.peek_score).to eq(-1_000_000 + scores.min)
+      scores.count {|s| s < 1000 }.times do heap.pop end
+      expect(heap.pop_with_score).to eq([:after, -999_000.5])
+    end
+
+    it "compares against transformed thresholds" do
+      heap.scale_scores!(2.0)
+      below = scores.select {|s| s * 2 < 50_000 }.sort
+      expect(heap.pop_all_below(50_000)).to eq(below)
+      expect(heap.pop_lt(heap.peek_score)).to be_nil
+      expect(heap.pop_lte(heap.peek_score)).not_to be_nil
+    end
+
+    it "compares thresholds with the same scores that #peek_score returns" do
+      fractions = DHeap.new
+      fractions.push(:a, 0.1)
+      fractions.shift_scores!(0.2)
+      expect(fractions.pop_lt(fractions.peek_score)).to be_nil
+      expect(fractions.pop_lte(fractions.peek_score)).to eq(:a)
+
+      100.times do
+        heap.shift_scores!(rand * 100 - 50.5).scale_scores!(rand * 3 + 0.01)
+        min = heap.peek
+        expect(heap.pop_lt(heap.peek_score)).to be_nil
+        expect(heap.pop_all_below(heap.peek_score.next_float)).to include(min)
+      end
+    end
+
+    it "compares against transforms made by the receiver of pop_all_below" do
+      receiver = Object.new
+      popped = []
+      shifted = heap
+      receiver.define_singleton_method(:<<) do |value|
+        shifted.shift_scores!(1_000_000) if popped.empty?
+        popped << value
+      end
+      heap.pop_all_below(100_000, receiver)
+      expect(popped).to eq([scores.min])
+      expect(heap.peek_score).to be >= 1_000_000
+    end
+
+    it "materializes the scores periodically" do
+      200.times do heap.shift_scores!(1).scale_scores!(1.001) end
+      expected = scores.map {|s| 200.times.reduce(s.to_f) {|x, _| (x + 1) * 1.001 } }
+      heap.each_pop(with_scores: true).to_a.map(&:last).zip(expected.sort) do |a, b|
+        expect(a).to be_within(1e-6).of(b)
+      end
+    end
+
+    it "is copied by dup" do
+      heap.shift_scores!(5)
+      copy = heap.dup
+      heap.shift_scores!(5)
+      expect(copy.peek_score).to eq(scores.min + 5.0)
+      expect(heap.peek_score).to eq(scores.min + 10.0)
+    end
+
+    it "resets on clear" do
+      heap.shift_scores!(5).clear
+      heap << 1
+      expect(heap.peek_score).to eq(1.0)
+    end
+
+    it "raises ArgumentError for non-finite deltas and non-positive factors" do
+      expect { heap.shift_scores!(Float::NAN) }.to raise_error(ArgumentError)
+      expect { heap.shift_scores!(Float::INFINITY) }.to raise_error(ArgumentError)
+      expect { heap.scale_scores!(0) }.to raise_error(ArgumentError)
+      expect { heap.scale_scores!(-1) }.to raise_error(ArgumentError)
+      expect { heap.scale_scores!(Float::NAN) }.to raise_error(ArgumentError)
+    end
+
+    it "raises FrozenError for frozen heaps" do
+      heap.freeze
+      expect { heap.shift_scores!(1) }.to raise_error(FrozenError)
+      expect { heap.scale_scores!(2) }.to raise_error(FrozenError)
+    end
+
+    it "raises TypeError with a memory_limit" do
+      spilled = DHeap.new(memory_limit: 1024)
+      expect { spilled.shift_scores!(1) }.to raise_error(TypeError)
+      expect { spilled.scale_scores!(2) }.to raise_error(TypeError)
+    end
+
+    it "transforms DHeap::Max scores" do
+      max = DHeap::Max.new
+      scores.each do |score| max << score end
+      max.shift_scores!(-10).scale_scores!(3)
+      expect(max.peek_score).to eq((scores.max - 10) * 3.0)
+      expect(max.pop_gte((scores.max - 10) * 3)).to eq(scores.max)
+      expect(max.each_pop(with_scores: true).to_a.map(&:last))
+        .to eq(scores.sort.reverse.drop(1).map {|s| (s - 10) * 3.0 })
+    end
+
+    it "compares DHeap::Max thresholds with the scores that #peek_score returns" do
+      max = DHeap::Max.new
+      scores.each do |score| max.push(score, score + 0.1) end
+      100.times do
+        max.shift_scores!(rand * 100 - 50.5).scale_scores!(rand * 3 + 0.01)
+        expect(max.pop_gt(max.peek_score)).to be_nil
+        expect(max.pop_gte(max.peek_score)).not_to be_nil
+      end
+    end
+
+    if defined?(DHeap::Map)
+      it "transforms DHeap::Map scores" do
+        map = DHeap::Map.new
+        scores.each_with_index do |score, i| map[i] = score end
+        map.shift_scores!(100)
+        expect(map[0]).to eq(scores[0] + 100.0)
+        map[0] = -1
+        expect(map.peek_with_score).to eq([0, -1.0])
+        map.scale_scores!(2)
+        expect(map[0]).to eq(-2.0)
+        expect(map[1]).to eq((scores[1] + 100) * 2.0)
+      end
+    end
+  end
+
+end
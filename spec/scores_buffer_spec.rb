@@ -0,0 +1,121 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  let(:scores) { Array.new(1000) { rand(10_000) / 10.0 } }
+  let(:values) { Array.new(1000) {|i| "v#{i}" } }
+
+  describe "#scores_buffer and #values" do
+    subject(:heap) { DHeap.new }
+
+    before do
+      values.zip(scores).each do |value, score| heap.push(value, score) end
+    end
+
+    it "returns packed scores and values in heap order, like #to_a" do
+      expect(heap.scores_buffer.unpack("D*")).to eq(heap.to_a.map(&:last))
+      expect(heap.values).to eq(heap.to_a.map(&:first))
+      expect(heap.scores_buffer.encoding).to eq(Encoding::BINARY)
+    end
+
+    it "returns empty buffers for an empty heap" do
+      heap.clear
+      expect(heap.scores_buffer).to eq("".b)
+      expect(heap.values).to eq([])
+    end
+
+    it "folds buffered pushes" do
+      heap.buffered = true
+      heap.push(:min, -1)
+      expect(heap.scores_buffer.unpack1("D")).to eq(-1.0)
+      expect(heap.values.first).to eq(:min)
+    end
+
+    it "includes spilled entries" do
+      spilled = DHeap.new(memory_limit: 64 * DHeap::Spill::ENTRY_SIZE)
+      values.zip(scores).each do |value, score| spilled.push(value, score) end
+      expect(spilled.scores_buffer.unpack("D*").sort).to eq(scores.sort)
+      expect(spilled.values.sort).to eq(values.sort)
+    end
+  end
+
+  describe ".from_buffer(scores, values = nil, threads: 1, **options)" do
+    it "builds a heap from packed scores" do
+      heap = DHeap.from_buffer(scores.pack("D*"), values)
+      expect(heap.size).to eq(values.size)
+      expect(heap.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+    end
+
+    it "builds a heap from an Array of scores" do
+      heap = DHeap.from_buffer(scores, values)
+      expect(heap.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+    end
+
+    it "uses the scores as values, without values" do
+      expect(DHeap.from_buffer([3, 1, 2]).each_pop.to_a).to eq([1, 2, 3])
+      expect(DHeap.from_buffer([3, 1, 2].pack("D*")).each_pop.to_a)
+        .to eq([1.0, 2.0, 3.0])
+      heap = DHeap.from_buffer(scores, memory_limit: 1024)
+      expect(heap.each_pop.to_a).to eq(scores.sort)
+    end
+
+    it "round trips with #scores_buffer and #values" do
+      heap = DHeap.from_buffer(scores.pack("D*"), values, d: 3)
+      copy = DHeap.from_buffer(heap.scores_buffer, heap.values, d: 3)
+      expect(copy.to_a).to eq(heap.to_a)
+      expect(copy.each_pop(with_scores: true).to_a.sort)
+        .to eq(values.zip(scores).sort)
+    end
+
+    it "passes options to new" do
+      heap = DHeap.from_buffer(scores.pack("D*"), values, d: 7, layout: :paged)
+      expect(heap.d).to eq(7)
+      expect(heap.layout).to eq(:paged)
+      expect(heap.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+      spilled = DHeap.from_buffer(scores.pack("D*"), values, memory_limit: 1024)
+      expect(spilled.spilled_size).to be > 0
+      expect(spilled.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+    end
+
+    it "raises ArgumentError when the sizes don't match" do
+      expect { DHeap.from_buffer([1.0].pack("D*"), [:a, :b]) }
+        .to raise_error(ArgumentError)
+      expect { DHeap.from_buffer("abc", [:a]) }.to raise_error(ArgumentError)
+      expect { DHeap.from_buffer([1.0], %i[a b]) }.to raise_error(ArgumentError)
+      expect { DHeap.from_buffer([1.0], threads: 0) }.to raise_error(ArgumentError)
+    end
+
+    if defined?(IO::Buffer)
+      it "reads IO::Buffer" do
+        buffer = IO::Buffer.for(scores.pack("D*"))
+        heap = DHeap.from_buffer(buffer, values)
+        expect(heap.each_pop(with_scores: true).to_a.map(&:last)).to eq(scores.sort)
+      end
+    end
+
+    if defined?(DHeap::Map)
+      it "builds a DHeap::Map, rescoring duplicates" do
+        map = DHeap::Map.from_buffer([3.0, 1.0, 2.0].pack("D*"), %i[a b a])
+        expect(map).to be_a(DHeap::Map)
+        expect(map.size).to eq(2)
+        expect(map[:a]).to eq(2.0)
+        expect(map.pop_with_score).to eq([:b, 1.0])
+        expect(map.pop_with_score).to eq([:a, 2.0])
+      end
+
+      it "stops buffering when a value's #hash raises" do
+        map = DHeap::Map.new
+        map[:z] = 0
+        bad = Object.new
+        def bad.hash; raise ArgumentError, "no hash" end
+        expect { map.__send__(:__load_buffer__, [3.0, 1.0, 2.0], [:a, bad, :c], 1) }
+          .to raise_error(ArgumentError, "no hash")
+        expect(map).not_to be_buffered
+        map[:b] = -1
+        expect(map.each_pop(with_scores: true).to_a)
+          .to eq([[:b, -1.0], [:z, 0.0], [:a, 3.0]])
+      end
+    end
+  end
+
+end
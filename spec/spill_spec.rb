@@ -0,0 +1,107 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  describe "memory_limit:" do
+    # 64 entries in memory
+    subject(:heap) { DHeap.new(memory_limit: 64 * DHeap::Spill::ENTRY_SIZE) }
+
+    let(:values) { Array.new(1000) {|i| i * 7 % 1000 } }
+
+    it "is disabled by default" do
+      expect(DHeap.new).not_to respond_to(:spilled_size)
+      expect(heap).to respond_to(:spilled_size)
+    end
+
+    it "rejects limits too small for two entries" do
+      expect { DHeap.new(memory_limit: 16) }.to raise_error(ArgumentError)
+    end
+
+    it "spills the largest entries and pops everything in order" do
+      values.each do |v| heap << v end
+      expect(heap.size).to eq(values.size)
+      expect(heap.spilled_size).to be > 0
+      expect(heap.spilled_runs).to be > 1
+      expect(heap.size - heap.spilled_size).to be <= 64
+      expect(heap.each_pop.to_a).to eq(values.sort)
+      expect(heap).to be_empty
+      expect(heap.spilled_runs).to eq(0)
+    end
+
+    it "interleaves pushes and pops" do
+      popped = []
+      values.each_slice(10) do |slice|
+        slice.each do |v| heap.push(v.to_s, v) end
+        popped << heap.pop_with_score
+      end
+      remaining = values.sort.map {|v| [v.to_s, v.to_f] } - popped
+      expect(heap.each_pop(with_scores: true).to_a).to eq(remaining)
+    end
+
+    it "supports peek, pop_lt, pop_lte, and pop_all_below across runs" do
+      values.each do |v| heap << v end
+      500.times do heap.pop end
+      expect(heap.peek).to eq(500)
+      expect(heap.peek_score).to eq(500)
+      expect(heap.peek_with_score).to eq([500, 500])
+      expect(heap.pop_lt(500)).to be_nil
+      expect(heap.pop_lte(500)).to eq(500)
+      expect(heap.pop_all_below(900)).to eq((501...900).to_a)
+      expect(heap.to_a.map(&:last).sort).to eq((900...1000).to_a)
+      expect(heap.size).to eq(100)
+    end
+
+    it "merges runs by level to bound the number of open files" do
+      count = 32 * DHeap::Spill::MERGE_WIDTH**2 * 2 # 512 runs of 32 entries
+      count.times do |i| heap << -i end
+      expect(heap.spilled_runs).to be <= DHeap::Spill::MERGE_WIDTH * 3
+      expect(heap.pop).to eq(-(count - 1))
+      expect(heap.each_pop.to_a).to eq(Array.new(count - 1) {|i| i - count + 2 })
+    end
+
+    it "rewrites each spilled entry once per merge level" do
+      dumper = Class.new {
+        attr_reader :loads
+        def initialize; @loads = 0 end
+        def dump(obj) obj.to_s end
+        def load(str) (@loads += 1) && str.to_i end
+      }.new
+      heap = DHeap.new(memory_limit: 64 * DHeap::Spill::ENTRY_SIZE, dumper: dumper)
+      count = 32 * DHeap::Spill::MERGE_WIDTH**2 * 2
+      count.times do |i| heap.push(i, rand(count)) end
+      # 512 runs are merged into 32 level 1 runs, then 2 level 2 runs
+      expect(dumper.loads).to be <= count * 2
+      expect(heap.each_pop.to_a.size).to eq(count)
+    end
+
+    it "serializes values with the dumper" do
+      dumper = Class.new {
+        attr_reader :dumps
+        def initialize; @dumps = 0 end
+        def dump(obj) (@dumps += 1) && obj.to_s end
+        def load(str) str.to_sym end
+      }.new
+      heap = DHeap.new(memory_limit: 4 * DHeap::Spill::ENTRY_SIZE, dumper: dumper)
+      %i[e d c b a f g h].each_with_index do |sym, i| heap.push(sym, 8 - i) end
+      expect(dumper.dumps).to be > 0
+      expect(heap.each_pop.to_a).to eq(%i[h g f a b c d e])
+    end
+
+    it "closes every run on clear" do
+      values.each do |v| heap << v end
+      heap.clear
+      expect(heap).to be_empty
+      expect(heap.size).to eq(0)
+      expect(heap.spilled_runs).to eq(0)
+      heap << 1
+      expect(heap.pop).to eq(1)
+    end
+
+    it "can't be copied" do
+      expect { heap.dup }.to raise_error(TypeError)
+      expect { heap.clone }.to raise_error(TypeError)
+    end
+
+  end
+
+end
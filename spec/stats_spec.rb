@@ -0,0 +1,86 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  unless DHeap.new.respond_to?(:stats)
+    it "raises NotImplementedError for stats: true" do
+      expect { DHeap.new(stats: true) }.to raise_error(NotImplementedError)
+    end
+    next
+  end
+
+  describe "#stats" do
+
+    it "returns nil unless enabled" do
+      expect(DHeap.new.stats).to be_nil
+    end
+
+    describe_any_size_heap "with stats: true" do
+      subject(:heap) { DHeap.new(d: d, stats: true, capacity: 2) }
+
+      it "starts with zeroed counters" do
+        stats = heap.stats
+        expect(stats[:pushes]).to eq(0)
+        expect(stats[:pops]).to eq(0)
+        expect(stats[:comparisons]).to eq(0)
+        expect(stats[:moves]).to eq(0)
+        expect(stats[:sift_up_depths]).to eq([])
+        expect(stats[:sift_down_depths]).to eq([])
+      end
+
+      it "counts pushes, pops, and sifts" do
+        100.downto(1) do |i| heap << i end
+        50.times do heap.pop end
+        stats = heap.stats
+        expect(stats[:pushes]).to eq(100)
+        expect(stats[:pops]).to eq(50)
+        expect(stats[:sift_up_depths].sum).to eq(100)
+        expect(stats[:sift_down_depths].sum).to eq(50)
+        expect(stats[:comparisons]).to be > 100
+        expect(stats[:moves]).to be >= 100
+        expect(stats[:capacity_growths]).to be > 0
+        expect(stats[:realloc_bytes]).to be > 0
+        expect(stats[:hash_ops]).to eq(0)
+      end
+
+      it "records one sift per push and pop, including sifts of zero depth" do
+        heap << 1
+        expect(heap.stats[:sift_up_depths]).to eq([1])
+        heap.pop
+        expect(heap.stats[:sift_down_depths]).to eq([1])
+        1.upto(100) do |i| heap << i end
+        expect(heap.stats[:sift_up_depths]).to eq([101])
+        100.times do heap.pop end
+        stats = heap.stats
+        expect(stats[:sift_up_depths].sum).to eq(stats[:pushes])
+        expect(stats[:sift_down_depths].sum).to eq(stats[:pops])
+        expect(stats[:sift_down_depths][0]).to be >= 2
+      end
+
+      it "can be reset" do
+        heap << 1 << 2 << 3
+        expect(heap.reset_stats).to equal(heap)
+        expect(heap.stats[:pushes]).to eq(0)
+        heap.pop
+        expect(heap.stats[:pops]).to eq(1)
+      end
+    end
+
+    if defined?(DHeap::Map)
+      it "counts DHeap::Map hash operations and rescores" do
+        heap = DHeap::Map.new(stats: true)
+        heap["a"] = 1
+        heap["b"] = 2
+        heap["a"] = 3
+        heap.pop
+        stats = heap.stats
+        expect(stats[:pushes]).to eq(2)
+        expect(stats[:rescores]).to eq(1)
+        expect(stats[:pops]).to eq(1)
+        expect(stats[:hash_ops]).to be > 4
+      end
+    end
+
+  end
+
+end
@@ -0,0 +1,81 @@
+# frozen_string_literal: true
+
+RSpec.describe DHeap do
+
+  let(:values) { Array.new(1000) { rand(10_000) } }
+
+  describe ".nsmallest" do
+
+    it "selects the k smallest, in ascending order" do
+      expect(DHeap.nsmallest(3, [5, 1, 4, 2, 3])).to eq([1, 2, 3])
+      [1, 2, 10, 100, 999].each do |k|
+        expect(DHeap.nsmallest(k, values)).to eq(values.sort.first(k))
+      end
+    end
+
+    it "returns everything (sorted) when k is at least the size" do
+      expect(DHeap.nsmallest(5, [3, 1, 2])).to eq([1, 2, 3])
+      expect(DHeap.nsmallest(1_000_000, values)).to eq(values.sort)
+    end
+
+    it "returns an empty Array when k is zero or the source is empty" do
+      expect(DHeap.nsmallest(0, values)).to eq([])
+      expect(DHeap.nsmallest(5, [])).to eq([])
+    end
+
+    it "raises for a negative k" do
+      expect { DHeap.nsmallest(-1, values) }.to raise_error(ArgumentError)
+    end
+
+    it "scores elements with by:" do
+      expect(DHeap.nsmallest(2, %w[ccc a dddd bb], by: :size)).to eq(%w[a bb])
+      expect(DHeap.nsmallest(2, [3, -1, 2], by: ->(x) { x.abs })).to eq([-1, 2])
+    end
+
+    it "reads other Enumerables with each" do
+      expect(DHeap.nsmallest(3, values.each)).to eq(values.sort.first(3))
+      expect(DHeap.nsmallest(2, 10.downto(1))).to eq([1, 2])
+    end
+
+    it "doesn't allocate k entries up front for Enumerables" do
+      expect(DHeap.nsmallest(10**12, 10.downto(1))).to eq((1..10).to_a)
+      many = Array.new(5000) { rand(100_000) }
+      expect(DHeap.nsmallest(3000, many.each)).to eq(many.sort.first(3000))
+      expect(DHeap.nsmallest(10**12, many.each)).to eq(many.sort)
+    end
+
+    it "scans packed doubles" do
+      floats = values.map(&:to_f)
+      packed = floats.pack("D*")
+      [1, 7, 8, 9, 100].each do |k|
+        expect(DHeap.nsmallest(k, packed)).to eq(floats.sort.first(k))
+      end
+      expect { DHeap.nsmallest(1, "abc") }.to raise_error(ArgumentError)
+    end
+
+    it "converts scores like push" do
+      times = [Time.at(3), Time.at(1), Time.at(2)]
+      expect(DHeap.nsmallest(2, times)).to eq([Time.at(1), Time.at(2)])
+      expect { DHeap.nsmallest(1, [:a]) }.to raise_error(TypeError)
+    end
+
+  end
+
+  describe ".nlargest" do
+
+    it "selects the k largest, in descending order" do
+      expect(DHeap.nlargest(2, [5, 1, 4, 2, 3])).to eq([5, 4])
+      [1, 10, 100].each do |k|
+        expect(DHeap.nlargest(k, values)).to eq(values.sort.reverse.first(k))
+      end
+    end
+
+    it "supports by: and packed doubles" do
+      expect(DHeap.nlargest(1, %w[ccc a dddd bb], by: :size)).to eq(%w[dddd])
+      floats = values.map(&:to_f)
+      expect(DHeap.nlargest(9, floats.pack("D*"))).to eq(floats.max(9))
+    end
+
+  end
+
+end
@@ -0,0 +1,225 @@
+# frozen_string_literal: true
+
+require "stringio"
+require "tmpdir"
+
+RSpec.describe DHeap, "#trace_to" do
+  trace = DHeap::Trace
+
+  let(:io) { StringIO.new(String.new(encoding: Encoding::BINARY)) }
+
+  def records(io)
+    data = io.string
+    expect(data).to start_with(DHeap::Trace::MAGIC)
+    ops, scores, ids = DHeap::Trace.parse(data)
+    ops.bytes.zip(scores, ids)
+  end
+
+  it "records ops, scores, and value ids" do
+    heap = DHeap.new
+    a = Object.new
+    b = Object.new
+    heap.trace_to(io) do
+      heap.push(a, 5)
+      heap.insert(3, b)
+      heap << 7
+      heap.peek
+      heap.pop
+      heap.pop_lt(4)
+      heap.pop_lte(5)
+      heap.pop_all_below(10)
+      heap.push(a, 1)
+      heap.clear
+    end
+    expect(records(io)).to eq([
+      [trace::PUSH, 5.0, 1],
+      [trace::PUSH, 3.0, 2],
+      [trace::PUSH, 7.0, 3],
+      [trace::PEEK, 0.0, 0],
+      [trace::POP, 0.0, 0],
+      [trace::POP_LT, 4.0, 0],
+      [trace::POP_LTE, 5.0, 0],
+      [trace::POP_ALL_BELOW, 10.0, 0],
+      [trace::PUSH, 1.0, 1],
+      [trace::CLEAR, 0.0, 0],
+    ])
+  end
+
+  it "records aliases" do
+    heap = DHeap.new
+    heap.trace_to(io) do
+      heap.enq 1
+      heap.first
+      heap.shift
+    end
+    expect(records(io).map(&:first)).to eq([trace::PUSH, trace::PEEK, trace::POP])
+  end
+
+  it "records push_pop and replace_top as a push and a pop" do
+    heap = DHeap.new
+    heap.trace_to(io) do
+      heap.push_pop(:a, 2)
+      heap.replace_top(:b, 3)
+    end
+    expect(records(io)).to eq([
+      [trace::PUSH, 2.0, 1],
+      [trace::POP, 0.0, 0],
+      [trace::POP, 0.0, 0],
+      [trace::PUSH, 3.0, 2],
+    ])
+  end
+
+  it "records scores as stored, after #shift_scores! and #scale_scores!" do
+    heap = DHeap.new
+    heap << 10
+    heap.shift_scores!(-10).scale_scores!(2)
+    heap.trace_to(io) do
+      heap.push(:a, 4)
+      heap.pop_lte(4)
+    end
+    expect(records(io)).to eq([
+      [trace::PUSH, 12.0, 1],
+      [trace::POP_LTE, 12.0, 0],
+    ])
+  end
+
+  it "records pop_due with the threshold that it used" do
+    heap = DHeap.new
+    heap.push(:due, 1.0)
+    heap.push(:later, 1.5)
+    def heap.__clock_now__(_clock) 1.0 end
+    heap.trace_to(io) do
+      expect(heap.pop_due).to eq([:due])
+    end
+    expect(records(io)).to eq([[trace::POP_ALL_BELOW, 1.0.next_float, 0]])
+    expect(heap.peek).to eq(:later)
+  end
+
+  it "stops recording with #stop_trace" do
+    heap = DHeap.new
+    heap.trace_to(io)
+    expect(heap).to be_tracing
+    heap << 1
+    expect(heap.stop_trace).to equal(heap)
+    expect(heap).not_to be_tracing
+    heap << 2
+    expect(records(io).length).to eq(1)
+    expect(heap.pop).to eq(1)
+  end
+
+  it "doesn't change the heap's behavior" do
+    heap = DHeap.new
+    values = Array.new(1000) { rand(100) }
+    heap.trace_to(io) do
+      values.each do |v| heap << v end
+      expect(heap.each_pop.to_a).to eq(values.sort)
+    end
+  end
+
+  if defined?(DHeap::Map)
+    it "records DHeap::Map rescores as pushes of an existing id" do
+      map = DHeap::Map.new
+      map.trace_to(io) do
+        map[:a] = 1
+        map[:b] = 2
+        map.rescore(:a, 3)
+      end
+      expect(records(io)).to eq([
+        [trace::PUSH, 1.0, 1],
+        [trace::PUSH, 2.0, 2],
+        [trace::PUSH, 3.0, 1],
+      ])
+    end
+  end
+
+  if defined?(DHeap::Map)
+    it "records DHeap::Map deletes" do
+      map = DHeap::Map.new
+      (1..6).each do |i| map[i] = i end
+      map.trace_to(io) do
+        map.delete(1)
+        map.delete_all([2, 3])
+        map.delete_if {|value, _| value == 4 }
+        map.reject! {|value, _| value == 9 }
+        map.keep_if {|value, _| value != 5 }
+        map.select! {|_, score| score < 6 }
+      end
+      expect(records(io).map {|op, _, id| [op, id] }).to eq([
+        [trace::DELETE, 1],
+        [trace::DELETE, 2],
+        [trace::DELETE, 3],
+        [trace::DELETE, 4],
+        [trace::DELETE, 5],
+        [trace::DELETE, 6],
+      ])
+      expect(map).to be_empty
+    end
+
+    it "replays DHeap::Map deletes" do
+      require "d_heap/benchmarks/replay"
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "map.trace")
+        map = DHeap::Map.new
+        map.trace_to(path) do
+          100.times do |i| map[i] = rand(100) end
+          map.delete_if {|value, _| value.odd? }
+        end
+        replay = DHeap::Benchmarks::Replay.new(
+          path,
+          implementations: [],
+          dheap_options: [{}],
+          repeat_count: 1,
+          io: StringIO.new
+        )
+        queue = DHeap::Map.new
+        replay.replay(queue, :map)
+        expect(queue.size).to eq(50)
+        expect(replay.call.map {|m| m.latencies.length }).to all(eq(150))
+      end
+    end
+  end
+
+  it "writes to a path and loads with DHeap::Trace.load" do
+    Dir.mktmpdir do |dir|
+      path = File.join(dir, "heap.trace")
+      heap = DHeap.new
+      heap.trace_to(path) do
+        5000.times do |i| heap.push(i, i % 100) end
+        heap.pop
+      end
+      ops, scores, ids = DHeap::Trace.load(path)
+      expect(ops.bytesize).to eq(5001)
+      expect(ops.getbyte(0)).to eq(trace::PUSH)
+      expect(ops.getbyte(5000)).to eq(trace::POP)
+      expect(scores.first(3)).to eq([0.0, 1.0, 2.0])
+      expect(ids.first(3)).to eq([1, 2, 3])
+    end
+  end
+
+  it "replays with DHeap::Benchmarks::Replay" do
+    require "d_heap/benchmarks/replay"
+    Dir.mktmpdir do |dir|
+      path = File.join(dir, "heap.trace")
+      heap = DHeap.new
+      heap.trace_to(path) do
+        300.times do |i| heap.push(i, rand(100)) && heap.pop_lt(30) end
+      end
+      replay = DHeap::Benchmarks::Replay.new(
+        path,
+        implementations: [DHeap::Benchmarks::IMPLEMENTATIONS.fetch(4)],
+        dheap_options: [{ d: 2 }, { d: :auto }],
+        repeat_count: 1,
+        io: StringIO.new
+      )
+      measurements = replay.call
+      expect(measurements.map {|m| m.variant.name }).to start_with(
+        "ruby binary heap", "DHeap d=2", "DHeap d=auto"
+      )
+      measurements.each do |m|
+        expect(m.latencies.length).to eq(600)
+        expect(m.ops_per_sec.first).to be > 0
+      end
+    end
+  end
+
+end